@@ -19,6 +19,7 @@ SOURCES += \
     TableViewer.cpp \
     Utilities/QuickSort.cpp \
     Utilities/Utilities.cpp \
+    flowdirection.cpp \
     geodatadownloader.cpp \
     geomertymapviewer.cpp \
     geometrybase.cpp \
@@ -33,12 +34,19 @@ SOURCES += \
     mainwindow.cpp \
     mapwidget.cpp \
     modelcreator.cpp \
+    nativeraster.cpp \
     node.cpp \
     path.cpp \
+    pixelbuffer.cpp \
     polyline.cpp \
     polylinegeodataset.cpp \
     polylineset.cpp \
+    rasterkernels.cpp \
+    rastersampler.cpp \
+    rastertilecache.cpp \
+    rasterview.cpp \
     streamnetwork.cpp \
+    validitymask.cpp \
     weatherdata.cpp \
     weatherdownloaderdlg.cpp
 
@@ -55,6 +63,8 @@ HEADERS += \
     Utilities/BTCSet.hpp \
     Utilities/QuickSort.h \
     Utilities/Utilities.h \
+    bitops.h \
+    flowdirection.h \
     geodatadownloader.h \
     geomertymapviewer.h \
     geometrybase.h \
@@ -68,12 +78,20 @@ HEADERS += \
     mainwindow.h \
     mapwidget.h \
     modelcreator.h \
+    nativeraster.h \
     node.h \
     path.h \
+    pixelbuffer.h \
     polyline.h \
     polylinegeodataset.h \
     polylineset.h \
+    rasterbuffer.h \
+    rasterkernels.h \
+    rastersampler.h \
+    rastertilecache.h \
+    rasterview.h \
     streamnetwork.h \
+    validitymask.h \
     weatherdata.h \
     weatherdownloaderdlg.h
 
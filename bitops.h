@@ -0,0 +1,67 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <cstdint>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/**
+ * @file bitops.h
+ * @brief Portable bit scans and population counts.
+ *
+ * One instruction with GCC/Clang builtins or MSVC intrinsics, a plain loop
+ * elsewhere. Scans are undefined for a zero argument, as the builtins are.
+ */
+
+/// Index of the lowest set bit of x (x != 0).
+inline int countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    int n = 0;
+    while (!(x & 1u)) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/// Number of zero bits above the highest set bit of x (x != 0).
+inline int countLeadingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<int>(index);
+#else
+    int n = 0;
+    while (!(x & (uint64_t(1) << 63))) {
+        x <<= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/// Number of set bits of x.
+inline int popCount(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return static_cast<int>(__popcnt64(x));
+#else
+    int n = 0;
+    for (; x; x &= x - 1) ++n;
+    return n;
+#endif
+}
+
+#endif // BITOPS_H
@@ -0,0 +1,1103 @@
+#include "flowdirection.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+const int kAccumulationTile = 256;  // tile edge for parallel accumulation
+const uint32_t kNoCell = UINT32_MAX;
+const uint64_t kNoNode = UINT64_MAX;
+
+/// Cells [i0, i1) x [j0, j1) of a raster of the given width.
+struct Tile {
+    int i0, j0, i1, j1;
+    int width;
+
+    bool contains(uint32_t k) const {
+        const int i = static_cast<int>(k % width), j = static_cast<int>(k / width);
+        return i >= i0 && i < i1 && j >= j0 && j < j1;
+    }
+    bool onBorder(uint32_t k) const {
+        const int i = static_cast<int>(k % width), j = static_cast<int>(k / width);
+        return i == i0 || i == i1 - 1 || j == j0 || j == j1 - 1;
+    }
+    size_t local(uint32_t k) const {
+        return static_cast<size_t>(k / width - j0) * (i1 - i0) + (k % width - i0);
+    }
+};
+
+/// Cell that cell k drains into, kNoCell if none.
+uint32_t receiver(const uint8_t* codes, int width, uint32_t k) {
+    int di, dj;
+    if (!flowOffset(codes[k], di, dj)) return kNoCell;
+    return static_cast<uint32_t>(static_cast<int64_t>(k) + static_cast<int64_t>(dj) * width + di);
+}
+
+/**
+ * Pass value(k) down every path within one tile, in topological order,
+ * ignoring flow that enters from outside it; value(k) returns a double&.
+ */
+template <typename Value>
+void propagateTile(const Tile& t, const uint8_t* codes, Value value) {
+    std::vector<uint8_t> pending(static_cast<size_t>(t.i1 - t.i0) * (t.j1 - t.j0), 0);  // at most 8 donors
+    for (int j = t.j0; j < t.j1; ++j) {
+        for (int i = t.i0; i < t.i1; ++i) {
+            const uint32_t r = receiver(codes, t.width, static_cast<uint32_t>(j) * t.width + i);
+            if (r != kNoCell && t.contains(r)) ++pending[t.local(r)];
+        }
+    }
+
+    std::vector<uint32_t> queue;
+    for (int j = t.j0; j < t.j1; ++j) {
+        for (int i = t.i0; i < t.i1; ++i) {
+            const uint32_t k = static_cast<uint32_t>(j) * t.width + i;
+            if (codes[k] != kFlowNoData && pending[t.local(k)] == 0) queue.push_back(k);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const uint32_t k = queue[head];
+        const uint32_t r = receiver(codes, t.width, k);
+        if (r == kNoCell || !t.contains(r)) continue;
+        value(r) += value(k);
+        if (--pending[t.local(r)] == 0) queue.push_back(r);
+    }
+}
+
+/// Accumulate within one tile, ignoring flow that enters from outside it.
+void accumulateTile(const Tile& t, const uint8_t* codes, double* acc) {
+    propagateTile(t, codes, [acc](uint32_t k) -> double& { return acc[k]; });
+}
+
+/**
+ * Add the flow entering tile t at cells entries[n].first to every cell
+ * downstream of them within the tile, in one linear pass however many
+ * paths overlap.
+ */
+void addTileInflow(const Tile& t, const uint8_t* codes, double* acc,
+                   const std::vector<std::pair<uint32_t, double>>& entries) {
+    if (entries.empty()) return;
+    std::vector<double> extra(static_cast<size_t>(t.i1 - t.i0) * (t.j1 - t.j0), 0.0);
+    for (const auto& [k, f] : entries) extra[t.local(k)] += f;
+    propagateTile(t, codes, [&](uint32_t k) -> double& { return extra[t.local(k)]; });
+    for (int j = t.j0; j < t.j1; ++j) {
+        for (int i = t.i0; i < t.i1; ++i) {
+            const uint32_t k = static_cast<uint32_t>(j) * t.width + i;
+            acc[k] += extra[t.local(k)];
+        }
+    }
+}
+
+/// Call fn(t) for t in [0, n) on up to `workers` threads.
+template <typename Fn>
+void forEachTile(size_t n, size_t workers, Fn fn) {
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t t = next++; t < n; t = next++) fn(t);
+    };
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < std::min(workers, n); ++w) pool.emplace_back(work);
+    work();
+    for (std::thread& th : pool) th.join();
+}
+
+/**
+ * Worker threads kept alive across the rounds of accumulateDependencies, so
+ * a round costs a wake-up rather than a thread start per worker.
+ */
+class RoundPool {
+public:
+    explicit RoundPool(size_t workers) {
+        for (size_t w = 1; w < workers; ++w) threads_.emplace_back([this] { serve(); });
+    }
+
+    ~RoundPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& th : threads_) th.join();
+    }
+
+    RoundPool(const RoundPool&) = delete;
+    RoundPool& operator=(const RoundPool&) = delete;
+
+    /// Call fn(items[n]) for every n, on the pool and the calling thread; returns when all are done.
+    void run(const std::vector<uint32_t>& items, const std::function<void(uint32_t)>& fn) {
+        if (threads_.empty() || items.size() < 2) {
+            for (uint32_t item : items) fn(item);  // too little to hand out
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items_ = &items;
+            fn_ = &fn;
+            next_ = 0;
+            busy_ = threads_.size();
+            ++generation_;
+        }
+        wake_.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return busy_ == 0; });
+    }
+
+private:
+    void drain() {
+        for (size_t n = next_++; n < items_->size(); n = next_++) (*fn_)((*items_)[n]);
+    }
+
+    void serve() {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+            }
+            drain();
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    const std::vector<uint32_t>* items_ = nullptr;
+    const std::function<void(uint32_t)>* fn_ = nullptr;
+    std::atomic<size_t> next_{0};
+    size_t generation_ = 0;
+    size_t busy_ = 0;
+    bool stop_ = false;
+};
+
+/// A tile-border cell in the graph that routes flow between tiles.
+struct BorderCell {
+    uint64_t cell;            ///< Cell index j * width + i in the whole grid.
+    uint64_t next = kNoNode;  ///< Next border cell downstream (cell index, later node index).
+    bool crosses = false;     ///< next is in another tile.
+    int pending = 0;          ///< Upstream border cells not yet routed.
+    double local = 0.0;       ///< Accumulation from inside the tile.
+    double add = 0.0;         ///< Flow from other tiles passing through this cell.
+    double inflow = 0.0;      ///< Part of add entering the tile at this cell.
+};
+
+/**
+ * First border cell of tile t at or downstream of cell k (k in t or kNoCell),
+ * kNoCell if the path ends inside the tile. Interior cells remember their
+ * answer in memo (one slot per tile cell, kNoCell - 1 = not yet known), so
+ * linking all border cells of a tile walks every interior path once.
+ */
+uint32_t nextBorderCell(const Tile& t, const uint8_t* codes, uint32_t k,
+                        std::vector<uint32_t>& memo, std::vector<uint32_t>& walked) {
+    const uint32_t unknown = kNoCell - 1;
+    walked.clear();
+    uint32_t found = kNoCell;
+    while (k != kNoCell) {
+        if (t.onBorder(k)) {
+            found = k;
+            break;
+        }
+        const uint32_t known = memo[t.local(k)];
+        if (known != unknown) {
+            found = known;
+            break;
+        }
+        walked.push_back(k);
+        k = receiver(codes, t.width, k);  // an interior cell drains within the tile
+    }
+    for (uint32_t w : walked) memo[t.local(w)] = found;
+    return found;
+}
+
+/// Route the flow between tiles through the border graph, filling add and inflow.
+void routeBorderGraph(std::vector<BorderCell>& nodes) {
+    std::unordered_map<uint64_t, uint64_t> node;
+    node.reserve(nodes.size());
+    for (size_t n = 0; n < nodes.size(); ++n) node.emplace(nodes[n].cell, n);
+    for (BorderCell& b : nodes) {
+        if (b.next == kNoNode) continue;
+        b.next = node.at(b.next);
+        ++nodes[b.next].pending;
+    }
+    std::vector<uint64_t> queue;
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        if (nodes[n].pending == 0) queue.push_back(n);
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const BorderCell& b = nodes[queue[head]];
+        if (b.next == kNoNode) continue;
+        BorderCell& down = nodes[b.next];
+        if (b.crosses) {
+            const double out = b.local + b.add;
+            down.add += out;
+            down.inflow += out;
+        } else {
+            down.add += b.add;  // b.local is already part of down.local
+        }
+        if (--down.pending == 0) queue.push_back(b.next);
+    }
+}
+
+}
+
+InflowIndex::InflowIndex(const RasterBuffer<uint8_t>& flowDirections)
+    : width_(flowDirections.width()), height_(flowDirections.height()),
+    offsets_(static_cast<size_t>(width_) * height_ + 1, 0)
+{
+    const uint8_t* codes = flowDirections.data();
+
+    // Pass 1: count the donors of every cell
+    for (int j = 0; j < height_; ++j) {
+        for (int i = 0; i < width_; ++i) {
+            int di, dj;
+            if (flowOffset(codes[static_cast<size_t>(j) * width_ + i], di, dj)) {
+                ++offsets_[static_cast<size_t>(j + dj) * width_ + (i + di) + 1];
+            }
+        }
+    }
+    for (size_t k = 1; k < offsets_.size(); ++k) offsets_[k] += offsets_[k - 1];
+
+    // Pass 2: place each donor in its receiver's slot
+    donors_.resize(offsets_.back());
+    std::vector<uint32_t> next(offsets_.begin(), offsets_.end() - 1);
+    for (int j = 0; j < height_; ++j) {
+        for (int i = 0; i < width_; ++i) {
+            const uint32_t k = static_cast<uint32_t>(j) * width_ + i;
+            int di, dj;
+            if (flowOffset(codes[k], di, dj)) {
+                donors_[next[static_cast<size_t>(j + dj) * width_ + (i + di)]++] = k;
+            }
+        }
+    }
+}
+
+std::vector<uint32_t> InflowIndex::upstream(uint32_t k, int& i0, int& j0, int& i1, int& j1) const {
+    // The result doubles as the BFS queue; single-flow directions form a tree,
+    // so no cell is reached twice and no visited set is needed
+    std::vector<uint32_t> cells(1, k);
+    i0 = i1 = static_cast<int>(k % width_);
+    j0 = j1 = static_cast<int>(k / width_);
+    for (size_t head = 0; head < cells.size(); ++head) {
+        for (const uint32_t* d = begin(cells[head]); d != end(cells[head]); ++d) {
+            const int i = static_cast<int>(*d % width_);
+            const int j = static_cast<int>(*d / width_);
+            i0 = std::min(i0, i); i1 = std::max(i1, i);
+            j0 = std::min(j0, j); j1 = std::max(j1, j);
+            cells.push_back(*d);
+        }
+    }
+    return cells;
+}
+
+void resolveFlats(RasterBuffer<uint8_t>& codes, const RasterBuffer<uint8_t>& equalNeighbors,
+                  const std::vector<std::pair<int,int>>& dirs) {
+    const int width = codes.width(), height = codes.height();
+    const int nd = static_cast<int>(std::min<size_t>(dirs.size(), 8));
+    uint8_t* code = codes.data();
+    const uint8_t* equal = equalNeighbors.data();
+    auto inside = [&](int i, int j) { return i >= 0 && i < width && j >= 0 && j < height; };
+
+    // A flat cell on the grid edge or next to nodata is an outlet: flow leaves the grid there
+    auto outlet = [&](int i, int j) {
+        for (int d = 0; d < nd; ++d) {
+            const int ni = i + dirs[d].first, nj = j + dirs[d].second;
+            if (!inside(ni, nj) || code[static_cast<size_t>(nj) * width + ni] == kFlowNoData) return true;
+        }
+        return false;
+    };
+
+    // Seeds: cells a flat drains into (low edges) and flat cells next to higher ground (high edges)
+    std::vector<uint32_t> low, high;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const uint32_t k = static_cast<uint32_t>(j) * width + i;
+            if (code[k] == kFlowNoData) continue;
+            const bool flat = (code[k] == kFlowNone);
+            bool lowEdge = flat && outlet(i, j), highEdge = false;
+            for (int d = 0; d < nd; ++d) {
+                const int ni = i + dirs[d].first, nj = j + dirs[d].second;
+                if (!inside(ni, nj)) continue;
+                const uint8_t nc = code[static_cast<size_t>(nj) * width + ni];
+                const bool same = (equal[k] >> d) & 1;
+                if (flat) {
+                    if (nc != kFlowNoData && nc != kFlowForeign && !same) highEdge = true;  // no lower neighbor, so it is higher
+                } else if (same && nc == kFlowNone) {
+                    lowEdge = true;
+                }
+            }
+            if (lowEdge) low.push_back(k);
+            if (highEdge) high.push_back(k);
+        }
+    }
+    if (low.empty()) return;
+
+    // Label each drainable flat (with the cells it drains into) by flooding equal elevations
+    std::vector<int32_t> label(static_cast<size_t>(width) * height, 0);
+    int32_t labels = 0;
+    std::vector<uint32_t> queue;
+    for (uint32_t seed : low) {
+        if (label[seed] != 0) continue;
+        label[seed] = ++labels;
+        queue.assign(1, seed);
+        for (size_t head = 0; head < queue.size(); ++head) {
+            const uint32_t k = queue[head];
+            const int i = static_cast<int>(k % width), j = static_cast<int>(k / width);
+            for (int d = 0; d < nd; ++d) {
+                if (!((equal[k] >> d) & 1)) continue;
+                const uint32_t n = static_cast<uint32_t>(j + dirs[d].second) * width + (i + dirs[d].first);
+                if (label[n] == 0) {
+                    label[n] = labels;
+                    queue.push_back(n);
+                }
+            }
+        }
+    }
+
+    // Breadth-first distance over the flat cells of a label, level by level
+    auto flood = [&](std::vector<uint32_t> level, auto visit) {
+        std::vector<uint32_t> nextLevel;
+        for (int32_t loops = 1; !level.empty(); ++loops) {
+            nextLevel.clear();
+            for (uint32_t k : level) {
+                if (!visit(k, loops)) continue;
+                const int i = static_cast<int>(k % width), j = static_cast<int>(k / width);
+                for (int d = 0; d < nd; ++d) {
+                    const int ni = i + dirs[d].first, nj = j + dirs[d].second;
+                    if (!inside(ni, nj)) continue;
+                    const uint32_t n = static_cast<uint32_t>(nj) * width + ni;
+                    if (label[n] == label[k] && code[n] == kFlowNone) nextLevel.push_back(n);
+                }
+            }
+            level.swap(nextLevel);
+        }
+    };
+
+    // Gradient away from higher terrain; height[l] is its largest step in flat l
+    std::vector<int32_t> mask(label.size(), 0);
+    std::vector<int32_t> flatHeight(labels + 1, 0);
+    high.erase(std::remove_if(high.begin(), high.end(), [&](uint32_t k) { return label[k] == 0; }), high.end());
+    flood(high, [&](uint32_t k, int32_t loops) {
+        if (mask[k] > 0) return false;
+        mask[k] = loops;
+        flatHeight[label[k]] = loops;
+        return true;
+    });
+
+    // Combine with the (twice as steep) gradient toward lower terrain; negative marks visited
+    flood(low, [&](uint32_t k, int32_t loops) {
+        if (mask[k] < 0) return false;
+        mask[k] = -((mask[k] > 0 ? flatHeight[label[k]] - mask[k] : 0) + 2 * loops);
+        return true;
+    });
+
+    // Each flat cell flows to its neighbor in the same flat with the smallest combined value
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const uint32_t k = static_cast<uint32_t>(j) * width + i;
+            if (code[k] != kFlowNone || label[k] == 0 || outlet(i, j)) continue;
+            int best = -1;
+            int32_t bestMask = -mask[k];
+            for (int d = 0; d < nd; ++d) {
+                const int ni = i + dirs[d].first, nj = j + dirs[d].second;
+                if (!inside(ni, nj)) continue;
+                const uint32_t n = static_cast<uint32_t>(nj) * width + ni;
+                if (label[n] == label[k] && mask[n] < 0 && -mask[n] < bestMask) {
+                    bestMask = -mask[n];
+                    best = d;
+                }
+            }
+            if (best >= 0) code[k] = flowCode(dirs[best].first, dirs[best].second);
+        }
+    }
+}
+
+void accumulateFlow(const RasterBuffer<uint8_t>& flowDirections, RasterBuffer<double>& acc, int threads) {
+    const int width = flowDirections.width(), height = flowDirections.height();
+    const uint8_t* codes = flowDirections.data();
+    double* a = acc.data();
+    if (width == 0 || height == 0) return;
+
+    const size_t workers = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    const int tileSize = workers > 1 ? kAccumulationTile : std::max(width, height);
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<Tile> tiles;
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            tiles.push_back({tx * tileSize, ty * tileSize, std::min(width, (tx + 1) * tileSize),
+                             std::min(height, (ty + 1) * tileSize), width});
+        }
+    }
+    if (tiles.size() == 1) {
+        accumulateTile(tiles[0], codes, a);
+        return;
+    }
+
+    // Pass 1: every tile on its own; then link each border cell to the next
+    // border cell on its downstream path (interior cells never leave the tile)
+    std::vector<std::vector<BorderCell>> borders(tiles.size());
+    forEachTile(tiles.size(), workers, [&](size_t ti) {
+        const Tile& t = tiles[ti];
+        accumulateTile(t, codes, a);
+        std::vector<uint32_t> memo(static_cast<size_t>(t.i1 - t.i0) * (t.j1 - t.j0), kNoCell - 1);
+        std::vector<uint32_t> walked;
+        for (int j = t.j0; j < t.j1; ++j) {
+            const bool edgeRow = (j == t.j0 || j == t.j1 - 1);
+            for (int i = t.i0; i < t.i1; i = (edgeRow || i == t.i1 - 1) ? i + 1 : t.i1 - 1) {
+                const uint32_t k = static_cast<uint32_t>(j) * width + i;
+                if (codes[k] == kFlowNoData) continue;
+                BorderCell b;
+                b.cell = k;
+                b.local = a[k];
+                uint32_t r = receiver(codes, width, k);
+                if (r != kNoCell && !t.contains(r)) {
+                    b.crosses = true;
+                } else {
+                    r = nextBorderCell(t, codes, r, memo, walked);
+                }
+                if (r != kNoCell) b.next = r;
+                borders[ti].push_back(b);
+            }
+        }
+    });
+
+    // Pass 2: route the flow between tiles through the (small) border graph
+    std::vector<BorderCell> nodes;
+    std::vector<size_t> tileBegin(tiles.size() + 1, 0);
+    for (size_t ti = 0; ti < tiles.size(); ++ti) {
+        nodes.insert(nodes.end(), borders[ti].begin(), borders[ti].end());
+        tileBegin[ti + 1] = nodes.size();
+        std::vector<BorderCell>().swap(borders[ti]);
+    }
+    routeBorderGraph(nodes);
+
+    // Pass 3: add the flow entering each tile along its paths through the tile
+    forEachTile(tiles.size(), workers, [&](size_t ti) {
+        std::vector<std::pair<uint32_t, double>> entries;
+        for (size_t n = tileBegin[ti]; n < tileBegin[ti + 1]; ++n) {
+            if (nodes[n].inflow != 0.0) entries.emplace_back(static_cast<uint32_t>(nodes[n].cell), nodes[n].inflow);
+        }
+        addTileInflow(tiles[ti], codes, a, entries);
+    });
+}
+
+namespace {
+
+const int kHalo = 2;  // rows and columns read around an out-of-core tile
+
+/// One tile of an out-of-core accumulation, framed by a halo of kHalo cells.
+struct HaloTile {
+    Tile t;                       ///< The tile's own cells, in frame coordinates.
+    int ox, oy;                   ///< Grid column and row of frame cell 0.
+    int gridWidth;
+    RasterBuffer<float> z;        ///< Elevations (NaN = nodata or off the grid).
+    RasterBuffer<uint8_t> codes;  ///< Flow directions; kFlowForeign on the halo, kFlowNoData where z is NaN.
+    RasterBuffer<uint8_t> equal;  ///< Bit d: neighbor d is a tile cell of the same elevation.
+    RasterBuffer<double> acc;     ///< Accumulation from inside the tile.
+
+    /// Grid index of frame cell k, and back.
+    uint64_t cell(uint32_t k) const {
+        return static_cast<uint64_t>(oy + static_cast<int>(k / t.width)) * gridWidth + (ox + static_cast<int>(k % t.width));
+    }
+    uint32_t frame(uint64_t c) const {
+        return static_cast<uint32_t>(static_cast<int>(c / gridWidth) - oy) * t.width
+             + static_cast<uint32_t>(static_cast<int>(c % gridWidth) - ox);
+    }
+};
+
+/// A flat cut off from its outlets by a tile seam leaves through `cell`, with direction `code`.
+struct FlatPort {
+    uint64_t cell;
+    uint8_t code;
+};
+
+/// Frame cell k (not on the frame's outer ring) has a strictly lower neighbor.
+bool drainsDownhill(const HaloTile& ht, uint32_t k, const std::vector<std::pair<int,int>>& dirs) {
+    const float* e = ht.z.data();
+    for (const auto& [di, dj] : dirs) {
+        if (e[static_cast<int64_t>(k) + static_cast<int64_t>(dj) * ht.t.width + di] < e[k]) return true;
+    }
+    return false;
+}
+
+/**
+ * Read tile r with its halo, route it and accumulate it locally. Halo cells
+ * keep their elevations but are foreign to the routing: a flat reaching the
+ * seam is not cut off there. A flat cell on the seam next to an equal cell
+ * that drains downhill in the neighboring tile flows into it; flats with no
+ * way out inside the tile leave through their port (see
+ * accumulateFlowOutOfCore) or stay kFlowNone. Deterministic, so every pass
+ * that loads a tile sees the same directions.
+ */
+HaloTile loadTile(int width, int height, const Tile& r, const std::vector<std::pair<int,int>>& dirs,
+                  double cellArea, const TileReader& read, const std::vector<FlatPort>& ports) {
+    const int w = r.i1 - r.i0 + 2 * kHalo, h = r.j1 - r.j0 + 2 * kHalo;
+    HaloTile ht{Tile{kHalo, kHalo, w - kHalo, h - kHalo, w}, r.i0 - kHalo, r.j0 - kHalo, width,
+                RasterBuffer<float>(w, h, std::nanf("")), RasterBuffer<uint8_t>(w, h, kFlowForeign),
+                RasterBuffer<uint8_t>(w, h, 0), RasterBuffer<double>(w, h, 0.0)};
+    const int ri0 = std::max(0, r.i0 - kHalo), rj0 = std::max(0, r.j0 - kHalo);
+    const int ri1 = std::min(width, r.i1 + kHalo), rj1 = std::min(height, r.j1 + kHalo);
+    read(ri0, rj0, ri1 - ri0, rj1 - rj0, ht.z.data() + ht.z.index(ri0 - ht.ox, rj0 - ht.oy), w);
+
+    const int nd = static_cast<int>(std::min<size_t>(dirs.size(), 8));
+    uint8_t codeOf[8];
+    for (int d = 0; d < nd; ++d) codeOf[d] = flowCode(dirs[d].first, dirs[d].second);
+
+    const Tile& t = ht.t;
+    const float* e = ht.z.data();
+    uint8_t* code = ht.codes.data();
+    uint8_t* eq = ht.equal.data();
+    double* a = ht.acc.data();
+    for (size_t k = 0; k < ht.z.size(); ++k) {
+        if (std::isnan(e[k])) code[k] = kFlowNoData;
+    }
+
+    bool flats = false;
+    for (int j = t.j0; j < t.j1; ++j) {
+        for (int i = t.i0; i < t.i1; ++i) {
+            const size_t k = static_cast<size_t>(j) * w + i;
+            const double zc = e[k];
+            if (std::isnan(zc)) continue;
+            uint8_t best = kFlowNone;
+            uint8_t same = 0;
+            double maxDrop = 0.0;
+            for (int d = 0; d < nd; ++d) {
+                const int ni = i + dirs[d].first, nj = j + dirs[d].second;
+                const double dz = zc - e[static_cast<size_t>(nj) * w + ni];  // NaN (nodata, off the grid) never wins
+                if (dz > maxDrop) {
+                    maxDrop = dz;
+                    best = codeOf[d];
+                } else if (dz == 0.0 && ni >= t.i0 && ni < t.i1 && nj >= t.j0 && nj < t.j1) {
+                    same |= static_cast<uint8_t>(1u << d);
+                }
+            }
+            code[k] = best;
+            a[k] = cellArea;
+            eq[k] = same;
+            flats = flats || (best == kFlowNone && same != 0);
+        }
+    }
+
+    // Seam cells of a flat whose equal neighbor across the seam drains downhill: the flat's low edge
+    for (int j = t.j0; j < t.j1; ++j) {
+        const bool edgeRow = (j == t.j0 || j == t.j1 - 1);
+        for (int i = t.i0; i < t.i1; i = (edgeRow || i == t.i1 - 1) ? i + 1 : t.i1 - 1) {
+            const uint32_t k = static_cast<uint32_t>(j) * w + i;
+            if (code[k] != kFlowNone) continue;
+            bool outlet = false;  // next to nodata or the grid edge: stays an outlet, as in resolveFlats
+            for (int d = 0; d < nd && !outlet; ++d) {
+                outlet = code[static_cast<uint32_t>(j + dirs[d].second) * w + (i + dirs[d].first)] == kFlowNoData;
+            }
+            for (int d = 0; d < nd && !outlet; ++d) {
+                const uint32_t n = static_cast<uint32_t>(j + dirs[d].second) * w + (i + dirs[d].first);
+                if (code[n] == kFlowForeign && e[n] == e[k] && drainsDownhill(ht, n, dirs)) {
+                    code[k] = codeOf[d];
+                    break;
+                }
+            }
+        }
+    }
+    for (const FlatPort& p : ports) code[ht.frame(p.cell)] = p.code;
+    if (flats) resolveFlats(ht.codes, ht.equal, dirs);
+
+    accumulateTile(t, code, a);
+    return ht;
+}
+
+/// A seam cell of a flat that the neighboring tile continues (see accumulateFlowOutOfCore).
+struct SeamFlatCell {
+    uint64_t cell;
+    int32_t component;  ///< Flat component in its tile, -1 if the cell drains.
+};
+
+/// Possible port of flat component `from`: its seam cell `cell` flowing (`code`) into `across`.
+struct SeamFlatEdge {
+    int64_t from;
+    uint64_t cell;
+    uint8_t code;
+    uint64_t across;
+};
+
+/**
+ * Link each border cell of a loaded tile to the next border cell downstream
+ * and, if flats is given, record the flats that continue across its seams.
+ */
+void collectBorders(const HaloTile& ht, const std::vector<std::pair<int,int>>& dirs,
+                    std::vector<BorderCell>& borders,
+                    std::vector<SeamFlatCell>* flats, std::vector<SeamFlatEdge>* edges) {
+    const Tile& t = ht.t;
+    const uint8_t* codes = ht.codes.data();
+    std::vector<uint32_t> memo(static_cast<size_t>(t.i1 - t.i0) * (t.j1 - t.j0), kNoCell - 1);
+    std::vector<uint32_t> walked;
+    std::vector<int32_t> component;  // per tile cell, built on first need
+    int32_t components = 0;
+    std::vector<uint32_t> queue;
+
+    // Flat cells next to nodata or the grid edge end their flow there, as resolveFlats has it
+    auto outlet = [&](uint32_t k) {
+        for (const auto& [di, dj] : dirs) {
+            if (codes[static_cast<int64_t>(k) + static_cast<int64_t>(dj) * t.width + di] == kFlowNoData) return true;
+        }
+        return false;
+    };
+
+    // Label of the undrained flat holding cell k, flooding it on first sight
+    auto flatComponent = [&](uint32_t k) {
+        if (component.empty()) component.assign(memo.size(), -1);
+        if (component[t.local(k)] >= 0) return component[t.local(k)];
+        component[t.local(k)] = components;
+        queue.assign(1, k);
+        for (size_t head = 0; head < queue.size(); ++head) {
+            const uint32_t c = queue[head];
+            for (size_t d = 0; d < dirs.size(); ++d) {
+                if (!((ht.equal.data()[c] >> d) & 1)) continue;
+                const uint32_t m = static_cast<uint32_t>(static_cast<int64_t>(c)
+                    + static_cast<int64_t>(dirs[d].second) * t.width + dirs[d].first);
+                if (codes[m] == kFlowNone && component[t.local(m)] < 0) {
+                    component[t.local(m)] = components;
+                    queue.push_back(m);
+                }
+            }
+        }
+        return components++;
+    };
+
+    borders.clear();
+    for (int j = t.j0; j < t.j1; ++j) {
+        const bool edgeRow = (j == t.j0 || j == t.j1 - 1);
+        for (int i = t.i0; i < t.i1; i = (edgeRow || i == t.i1 - 1) ? i + 1 : t.i1 - 1) {
+            const uint32_t k = static_cast<uint32_t>(j) * t.width + i;
+            if (codes[k] == kFlowNoData) continue;
+            BorderCell b;
+            b.cell = ht.cell(k);
+            b.local = ht.acc.data()[k];
+            uint32_t n = receiver(codes, t.width, k);
+            if (n != kNoCell && !t.contains(n)) {
+                b.crosses = true;  // into the halo, i.e. the neighboring tile
+            } else {
+                n = nextBorderCell(t, codes, n, memo, walked);
+            }
+            if (n != kNoCell) b.next = ht.cell(n);
+            borders.push_back(b);
+
+            // A flat continuing into the neighboring tile: record how this side drains
+            if (!flats || drainsDownhill(ht, k, dirs)) continue;
+            const float* e = ht.z.data();
+            int32_t part = -2;  // not yet known
+            for (size_t d = 0; d < dirs.size(); ++d) {
+                const uint32_t q = static_cast<uint32_t>(j + dirs[d].second) * t.width + (i + dirs[d].first);
+                if (codes[q] != kFlowForeign || e[q] != e[k] || drainsDownhill(ht, q, dirs)) continue;
+                if (part == -2) {
+                    part = codes[k] == kFlowNone && !outlet(k) ? flatComponent(k) : -1;
+                    flats->push_back({b.cell, part});
+                }
+                if (part < 0) break;  // drains (or is an outlet) on this side
+                edges->push_back({part, b.cell, flowCode(dirs[d].first, dirs[d].second), ht.cell(q)});
+            }
+        }
+    }
+}
+
+}
+
+void accumulateFlowOutOfCore(int width, int height, int tileSize, const std::vector<std::pair<int,int>>& dirs,
+                             double cellArea, const TileReader& read, const TileWriter& write, int threads) {
+    if (width == 0 || height == 0) return;
+    const size_t workers = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<Tile> tiles;  // in grid coordinates
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            tiles.push_back({tx * tileSize, ty * tileSize, std::min(width, (tx + 1) * tileSize),
+                             std::min(height, (ty + 1) * tileSize), width});
+        }
+    }
+    std::vector<std::vector<FlatPort>> ports(tiles.size());
+
+    // Pass 1: accumulate every tile on its own and keep only its border cells,
+    // each linked to the next border cell downstream, and its seam flats
+    std::vector<std::vector<BorderCell>> borders(tiles.size());
+    std::vector<std::vector<SeamFlatCell>> seamFlats(tiles.size());
+    std::vector<std::vector<SeamFlatEdge>> seamEdges(tiles.size());
+    forEachTile(tiles.size(), workers, [&](size_t ti) {
+        const HaloTile ht = loadTile(width, height, tiles[ti], dirs, cellArea, read, ports[ti]);
+        collectBorders(ht, dirs, borders[ti], &seamFlats[ti], &seamEdges[ti]);
+    });
+
+    // Flats cut by seams: drain each undrained part toward the nearest part
+    // (in parts crossed) that drains, one breadth-first search over the parts
+    std::vector<int64_t> offset(tiles.size() + 1, 0);
+    std::unordered_map<uint64_t, int64_t> status;  // seam flat cell -> global part, -1 if it drains
+    for (size_t ti = 0; ti < tiles.size(); ++ti) {
+        int32_t parts = 0;
+        for (const SeamFlatCell& f : seamFlats[ti]) parts = std::max(parts, f.component + 1);
+        offset[ti + 1] = offset[ti] + parts;
+        for (const SeamFlatCell& f : seamFlats[ti]) status.emplace(f.cell, f.component < 0 ? -1 : offset[ti] + f.component);
+        std::vector<SeamFlatCell>().swap(seamFlats[ti]);
+    }
+    if (offset.back() > 0) {
+        std::vector<SeamFlatEdge> edges;
+        std::vector<size_t> edgeTile;
+        for (size_t ti = 0; ti < tiles.size(); ++ti) {
+            for (SeamFlatEdge& e : seamEdges[ti]) {
+                e.from += offset[ti];
+                edges.push_back(e);
+                edgeTile.push_back(ti);
+            }
+            std::vector<SeamFlatEdge>().swap(seamEdges[ti]);
+        }
+        std::vector<int64_t> port(offset.back(), -1);  // chosen edge per part
+        std::vector<std::vector<size_t>> incoming(offset.back());
+        std::vector<int64_t> queue;
+        for (size_t n = 0; n < edges.size(); ++n) {
+            const auto it = status.find(edges[n].across);
+            if (it == status.end()) continue;
+            if (it->second >= 0) {
+                incoming[it->second].push_back(n);
+            } else if (port[edges[n].from] < 0) {
+                port[edges[n].from] = static_cast<int64_t>(n);
+                queue.push_back(edges[n].from);
+            }
+        }
+        for (size_t head = 0; head < queue.size(); ++head) {
+            for (size_t n : incoming[queue[head]]) {
+                if (port[edges[n].from] >= 0) continue;
+                port[edges[n].from] = static_cast<int64_t>(n);
+                queue.push_back(edges[n].from);
+            }
+        }
+        std::vector<uint32_t> rerouted;
+        for (int64_t p : port) {
+            if (p < 0) continue;  // no outlet anywhere: stays a sink, as in memory
+            const size_t ti = edgeTile[p];
+            if (ports[ti].empty()) rerouted.push_back(static_cast<uint32_t>(ti));
+            ports[ti].push_back({edges[p].cell, edges[p].code});
+        }
+
+        // Tiles whose flats got a port are routed again
+        forEachTile(rerouted.size(), workers, [&](size_t n) {
+            const size_t ti = rerouted[n];
+            const HaloTile ht = loadTile(width, height, tiles[ti], dirs, cellArea, read, ports[ti]);
+            collectBorders(ht, dirs, borders[ti], nullptr, nullptr);
+        });
+    }
+    status.clear();
+
+    // Pass 2: route the flow between tiles through the border graph
+    std::vector<BorderCell> nodes;
+    std::vector<size_t> tileBegin(tiles.size() + 1, 0);
+    for (size_t ti = 0; ti < tiles.size(); ++ti) {
+        nodes.insert(nodes.end(), borders[ti].begin(), borders[ti].end());
+        tileBegin[ti + 1] = nodes.size();
+        std::vector<BorderCell>().swap(borders[ti]);
+    }
+    routeBorderGraph(nodes);
+
+    // Pass 3: reload every tile, add the flow entering it along its paths and write it out
+    forEachTile(tiles.size(), workers, [&](size_t ti) {
+        const Tile& r = tiles[ti];
+        HaloTile ht = loadTile(width, height, r, dirs, cellArea, read, ports[ti]);
+        const uint8_t* codes = ht.codes.data();
+        double* a = ht.acc.data();
+        std::vector<std::pair<uint32_t, double>> entries;
+        for (size_t n = tileBegin[ti]; n < tileBegin[ti + 1]; ++n) {
+            if (nodes[n].inflow != 0.0) entries.emplace_back(ht.frame(nodes[n].cell), nodes[n].inflow);
+        }
+        addTileInflow(ht.t, codes, a, entries);
+
+        const int w = r.i1 - r.i0, h = r.j1 - r.j0;
+        std::vector<float> out(static_cast<size_t>(w) * h);
+        for (int j = 0; j < h; ++j) {
+            for (int i = 0; i < w; ++i) {
+                const size_t k = ht.codes.index(i + kHalo, j + kHalo);
+                out[static_cast<size_t>(j) * w + i] = codes[k] == kFlowNoData ? std::nanf("")
+                                                                              : static_cast<float>(a[k]);
+            }
+        }
+        write(r.i0, r.j0, w, h, out.data());
+    });
+}
+
+namespace {
+
+/**
+ * Dependency-driven accumulation over any flow DAG described by a router:
+ *   bool valid(k)                        - cell takes part;
+ *   int route(k, i, j, to, frac)         - receivers and fractions (at most 8);
+ *   uint8_t donors(k, i, j)              - number of cells routing into k.
+ * The grid is cut into tiles processed in parallel rounds; flow crossing a
+ * tile border goes into a box per (tile, neighbor tile) that the receiving
+ * tile drains in the next round, so no cell is touched by two threads. A
+ * round only visits the tiles that were sent flow, on a pool that lives
+ * for all rounds, so a river crossing a tile seam many times costs a few
+ * busy tiles per round rather than a sweep over the grid; a round with a
+ * single busy tile runs on the calling thread.
+ */
+template <typename Router>
+void accumulateDependencies(int width, int height, const Router& router, double* a, int threads) {
+    const size_t workers = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    const int tileSize = workers > 1 ? kAccumulationTile : std::max(width, height);
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<Tile> tiles;
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            tiles.push_back({tx * tileSize, ty * tileSize, std::min(width, (tx + 1) * tileSize),
+                             std::min(height, (ty + 1) * tileSize), width});
+        }
+    }
+
+    // One pool for all rounds; later rounds only visit tiles that were sent flow
+    RoundPool pool(std::min(workers, tiles.size()));
+    std::vector<uint32_t> active(tiles.size());
+    for (size_t ti = 0; ti < tiles.size(); ++ti) active[ti] = static_cast<uint32_t>(ti);
+    std::unique_ptr<std::atomic<bool>[]> woken(new std::atomic<bool>[tiles.size()]);
+    for (size_t ti = 0; ti < tiles.size(); ++ti) woken[ti] = false;
+
+    // Donors still to be processed, per cell; only the owning tile touches it
+    std::vector<uint8_t> pending(static_cast<size_t>(width) * height, 0);
+    pool.run(active, [&](uint32_t ti) {
+        const Tile& t = tiles[ti];
+        for (int j = t.j0; j < t.j1; ++j) {
+            for (int i = t.i0; i < t.i1; ++i) {
+                const uint32_t k = static_cast<uint32_t>(j) * width + i;
+                if (router.valid(k)) pending[k] = router.donors(k, i, j);
+            }
+        }
+    });
+
+    // boxes[round parity][tile * 9 + slot], slot (dty + 1) * 3 + (dtx + 1) naming the receiving tile
+    typedef std::vector<std::pair<uint32_t, double>> Box;
+    std::vector<Box> boxes[2] = { std::vector<Box>(tiles.size() * 9), std::vector<Box>(tiles.size() * 9) };
+
+    for (int round = 0; !active.empty(); ++round) {
+        pool.run(active, [&](uint32_t ti) {
+            const Tile& t = tiles[ti];
+            const int tx = static_cast<int>(ti) % tilesX, ty = static_cast<int>(ti) / tilesX;
+            std::vector<uint32_t> queue;
+
+            if (round == 0) {
+                for (int j = t.j0; j < t.j1; ++j) {
+                    for (int i = t.i0; i < t.i1; ++i) {
+                        const uint32_t k = static_cast<uint32_t>(j) * width + i;
+                        if (pending[k] == 0 && router.valid(k)) queue.push_back(k);
+                    }
+                }
+            } else {
+                // Receive what the neighboring tiles sent last round
+                for (int s = 0; s < 9; ++s) {
+                    const int sx = tx + s % 3 - 1, sy = ty + s / 3 - 1;
+                    if (s == 4 || sx < 0 || sx >= tilesX || sy < 0 || sy >= tilesY) continue;
+                    Box& box = boxes[(round - 1) & 1][(static_cast<size_t>(sy) * tilesX + sx) * 9 + (8 - s)];
+                    for (const auto& [k, f] : box) {
+                        a[k] += f;
+                        if (--pending[k] == 0) queue.push_back(k);
+                    }
+                    box.clear();
+                }
+            }
+
+            uint32_t to[8];
+            double frac[8];
+            for (size_t head = 0; head < queue.size(); ++head) {
+                const uint32_t k = queue[head];
+                const int n = router.route(k, static_cast<int>(k % width), static_cast<int>(k / width), to, frac);
+                const double contrib = a[k];
+                for (int q = 0; q < n; ++q) {
+                    const double f = contrib * frac[q];
+                    if (t.contains(to[q])) {
+                        a[to[q]] += f;
+                        if (--pending[to[q]] == 0) queue.push_back(to[q]);
+                    } else {
+                        const int dtx = static_cast<int>(to[q] % width) / tileSize - tx;
+                        const int dty = static_cast<int>(to[q] / width) / tileSize - ty;
+                        boxes[round & 1][ti * 9 + (dty + 1) * 3 + (dtx + 1)].emplace_back(to[q], f);
+                        woken[static_cast<size_t>(ty + dty) * tilesX + (tx + dtx)] = true;
+                    }
+                }
+            }
+        });
+
+        active.clear();
+        for (size_t ti = 0; ti < tiles.size(); ++ti) {
+            if (woken[ti].exchange(false)) active.push_back(static_cast<uint32_t>(ti));
+        }
+    }
+}
+
+/// Freeman MFD: all strictly lower neighbors, weighted by (drop / distance)^exponent.
+struct MFDRouter {
+    const float* z;
+    int width, height;
+    const std::vector<std::pair<int,int>>& dirs;
+    int nd;
+    int64_t offset[8];
+    double dist[8];
+    double exponent;
+    bool linear;
+
+    MFDRouter(const RasterBuffer<float>& dem, const std::vector<std::pair<int,int>>& d, double e)
+        : z(dem.data()), width(dem.width()), height(dem.height()), dirs(d),
+          nd(static_cast<int>(std::min<size_t>(d.size(), 8))), exponent(e), linear(e == 1.0)
+    {
+        for (int k = 0; k < nd; ++k) {
+            offset[k] = static_cast<int64_t>(dirs[k].second) * width + dirs[k].first;
+            dist[k] = (dirs[k].first == 0 || dirs[k].second == 0) ? 1.0 : std::sqrt(2.0);
+        }
+    }
+
+    bool inside(int i, int j) const { return i >= 0 && i < width && j >= 0 && j < height; }
+
+    bool valid(uint32_t k) const { return !std::isnan(z[k]); }
+
+    uint8_t donors(uint32_t k, int i, int j) const {
+        uint8_t higher = 0;
+        for (int d = 0; d < nd; ++d) {
+            if (inside(i + dirs[d].first, j + dirs[d].second) && z[k + offset[d]] - z[k] > 0) ++higher;
+        }
+        return higher;
+    }
+
+    int route(uint32_t k, int i, int j, uint32_t* to, double* frac) const {
+        int n = 0;
+        double sumw = 0.0;
+        for (int d = 0; d < nd; ++d) {
+            if (!inside(i + dirs[d].first, j + dirs[d].second)) continue;
+            const uint32_t nk = static_cast<uint32_t>(k + offset[d]);
+            const double dz = z[k] - z[nk];
+            if (dz > 0) {
+                const double w = linear ? dz / dist[d] : std::pow(dz / dist[d], exponent);
+                to[n] = nk;
+                frac[n++] = w;
+                sumw += w;
+            }
+        }
+        for (int q = 0; q < n; ++q) frac[q] = sumw > 0.0 ? frac[q] / sumw : 0.0;
+        return n;
+    }
+};
+
+/// Directions counterclockwise from east on a north-up raster: E, NE, N, NW, W, SW, S, SE.
+constexpr int kAngleDX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+constexpr int kAngleDY[8] = { 0, -1, -1, -1, 0, 1, 1, 1 };
+const double kQuarterPi = std::atan(1.0);
+
+/// D-infinity: the two neighbors bracketing the flow angle, split by angular proximity.
+struct DInfRouter {
+    const float* z;
+    const float* angle;
+    int width, height;
+
+    bool valid(uint32_t k) const { return !std::isnan(z[k]); }
+
+    int route(uint32_t k, int i, int j, uint32_t* to, double* frac) const {
+        const double theta = angle[k];
+        if (!(theta >= 0)) return 0;  // no flow or nodata
+        const double f = theta / kQuarterPi;
+        const int m = std::min(7, static_cast<int>(f));
+        const double p = f - m;  // share of direction m + 1
+        const int dir[2] = { m, (m + 1) % 8 };
+        const double share[2] = { 1.0 - p, p };
+
+        // Keep only strictly lower receivers, so rounding can never close a cycle
+        int n = 0;
+        double sum = 0.0;
+        for (int q = 0; q < 2; ++q) {
+            const int ni = i + kAngleDX[dir[q]], nj = j + kAngleDY[dir[q]];
+            if (share[q] <= 0.0 || ni < 0 || ni >= width || nj < 0 || nj >= height) continue;
+            const uint32_t nk = static_cast<uint32_t>(nj) * width + ni;
+            if (!(z[nk] < z[k])) continue;
+            to[n] = nk;
+            frac[n++] = share[q];
+            sum += share[q];
+        }
+        for (int q = 0; q < n; ++q) frac[q] /= sum;
+        return n;
+    }
+
+    uint8_t donors(uint32_t k, int i, int j) const {
+        uint8_t count = 0;
+        uint32_t to[8];
+        double frac[8];
+        for (int d = 0; d < 8; ++d) {
+            const int ni = i + kAngleDX[d], nj = j + kAngleDY[d];
+            if (ni < 0 || ni >= width || nj < 0 || nj >= height) continue;
+            const uint32_t nk = static_cast<uint32_t>(nj) * width + ni;
+            const int n = route(nk, ni, nj, to, frac);
+            for (int q = 0; q < n; ++q) count += (to[q] == k);
+        }
+        return count;
+    }
+};
+
+}
+
+void accumulateFlowMFD(const RasterBuffer<float>& dem, const std::vector<std::pair<int,int>>& dirs,
+                       double exponent, RasterBuffer<double>& acc, int threads) {
+    if (dem.width() == 0 || dem.height() == 0) return;
+    accumulateDependencies(dem.width(), dem.height(), MFDRouter(dem, dirs, exponent), acc.data(), threads);
+}
+
+RasterBuffer<float> dinfAngles(const RasterBuffer<float>& dem) {
+    const int width = dem.width(), height = dem.height();
+    RasterBuffer<float> out(width, height, kFlowAngleNone);
+    const float* z = dem.data();
+    float* o = out.data();
+    auto at = [&](int i, int j) {
+        return (i < 0 || i >= width || j < 0 || j >= height) ? std::nan("") : static_cast<double>(z[static_cast<size_t>(j) * width + i]);
+    };
+
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const double e0 = at(i, j);
+            if (std::isnan(e0)) {
+                o[out.index(i, j)] = std::nanf("");
+                continue;
+            }
+            // Facet f spans the angles [f, f + 1] * pi/4, between a cardinal and a diagonal neighbor
+            double best = 0.0, bestAngle = kFlowAngleNone;
+            for (int f = 0; f < 8; ++f) {
+                const int c = (f % 2 == 0) ? f : (f + 1) % 8;  // cardinal
+                const int g = (f % 2 == 0) ? f + 1 : f;        // diagonal
+                const double e1 = at(i + kAngleDX[c], j + kAngleDY[c]);
+                const double e2 = at(i + kAngleDX[g], j + kAngleDY[g]);
+                if (std::isnan(e1) || std::isnan(e2)) continue;
+
+                const double s1 = e0 - e1, s2 = e1 - e2;
+                double r = std::atan2(s2, s1), slope = std::hypot(s1, s2);
+                if (r < 0) {
+                    r = 0;
+                    slope = s1;
+                } else if (r > kQuarterPi) {
+                    r = kQuarterPi;
+                    slope = (e0 - e2) / std::sqrt(2.0);
+                }
+                if (slope > best) {
+                    best = slope;
+                    bestAngle = (f % 2 == 0) ? f * kQuarterPi + r : (f + 1) * kQuarterPi - r;
+                    if (bestAngle >= 8 * kQuarterPi) bestAngle -= 8 * kQuarterPi;
+                }
+            }
+            o[out.index(i, j)] = static_cast<float>(bestAngle);
+        }
+    }
+    return out;
+}
+
+void accumulateFlowDInf(const RasterBuffer<float>& dem, const RasterBuffer<float>& angles,
+                        RasterBuffer<double>& acc, int threads) {
+    if (dem.width() == 0 || dem.height() == 0) return;
+    accumulateDependencies(dem.width(), dem.height(),
+                           DInfRouter{dem.data(), angles.data(), dem.width(), dem.height()}, acc.data(), threads);
+}
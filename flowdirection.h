@@ -0,0 +1,204 @@
+#ifndef FLOWDIRECTION_H
+#define FLOWDIRECTION_H
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "bitops.h"
+#include "rasterbuffer.h"
+
+/**
+ * @file flowdirection.h
+ * @brief ESRI D8 flow-direction codes, their inverse (the inflow index) and
+ *        flow accumulation over them.
+ *
+ * A cell draining to its neighbor at column/row offset (kFlowDX[d], kFlowDY[d])
+ * stores the code 1 << d: 1 = E, 2 = SE, 4 = S, 8 = SW, 16 = W, 32 = NW,
+ * 64 = N, 128 = NE on a north-up raster. These are the codes written by
+ * GeoDataDownloader::computeFlowDirection. D4 directions use the same codes
+ * restricted to 1, 4, 16 and 64.
+ *
+ * D-infinity directions are angles in radians in [0, 2 pi), counterclockwise
+ * from east on a north-up raster; kFlowAngleNone marks cells without
+ * downslope flow and NaN marks nodata.
+ */
+
+constexpr uint8_t kFlowNone = 0;      ///< No downslope neighbor (pit, flat or edge).
+constexpr uint8_t kFlowForeign = 254;  ///< Outside the region being routed (a tile halo); not an outlet.
+constexpr uint8_t kFlowNoData = 255;  ///< DEM nodata.
+
+constexpr float kFlowAngleNone = -1.0f;  ///< D-infinity angle of a cell without downslope flow.
+
+constexpr int kFlowDX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+constexpr int kFlowDY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+/// Code of the direction (di, dj), each in {-1, 0, 1}; kFlowNone for (0, 0).
+inline uint8_t flowCode(int di, int dj) {
+    for (int d = 0; d < 8; ++d) {
+        if (kFlowDX[d] == di && kFlowDY[d] == dj) return static_cast<uint8_t>(1u << d);
+    }
+    return kFlowNone;
+}
+
+/// Offset of the neighbor a code points to; false for kFlowNone, kFlowNoData or invalid codes.
+inline bool flowOffset(uint8_t code, int& di, int& dj) {
+    if (code == 0 || (code & (code - 1)) != 0) return false;  // exactly one bit set
+    const int d = countTrailingZeros(code);
+    di = kFlowDX[d];
+    dj = kFlowDY[d];
+    return true;
+}
+
+/**
+ * @class InflowIndex
+ * @brief Compressed (CSR) list of the upstream neighbors of every cell.
+ *
+ * The inverse of a flow-direction layer: the cells draining directly into
+ * cell k are the range [begin(k), end(k)). Built in two linear passes into
+ * two flat arrays (offsets and donors), so walking a whole basin upstream
+ * touches only contiguous memory. Cell indices are j * width + i and must
+ * fit in 32 bits.
+ */
+class InflowIndex {
+public:
+    /// Invert a layer of flow-direction codes.
+    explicit InflowIndex(const RasterBuffer<uint8_t>& flowDirections);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    /// Cells draining directly into cell k.
+    const uint32_t* begin(uint32_t k) const { return donors_.data() + offsets_[k]; }
+    const uint32_t* end(uint32_t k) const { return donors_.data() + offsets_[k + 1]; }
+
+    /**
+     * @brief Every cell draining to cell k (k included), in breadth-first order from k.
+     * @param[out] i0,j0,i1,j1 Inclusive bounding box of the returned cells.
+     */
+    std::vector<uint32_t> upstream(uint32_t k, int& i0, int& j0, int& i1, int& j1) const;
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    std::vector<uint32_t> offsets_;  ///< Size width * height + 1.
+    std::vector<uint32_t> donors_;
+};
+
+/**
+ * @brief Route flats toward their outlets without changing elevations.
+ *
+ * Barnes et al.'s "improved flats" in linear time: every drainable flat (a
+ * connected region of equal elevation whose cells lack a downslope neighbor)
+ * gets directions that lead away from higher terrain and toward lower
+ * terrain, following the combination of the two breadth-first distance
+ * gradients. A flat drains where it touches a cell that already flows
+ * downhill, or where it meets the grid edge or nodata; those edge cells stay
+ * kFlowNone as the flat's outlets. Flats with no outlet stay kFlowNone.
+ * kFlowForeign cells are neither outlets nor higher terrain.
+ *
+ * @param[in,out] codes Flow directions over the neighbors dirs (kFlowNone on flats).
+ * @param equalNeighbors Per cell, bit d set if neighbor dirs[d] has the same elevation.
+ * @param dirs Neighbor offsets (i, j); at most 8, each with its opposite.
+ */
+void resolveFlats(RasterBuffer<uint8_t>& codes, const RasterBuffer<uint8_t>& equalNeighbors,
+                  const std::vector<std::pair<int,int>>& dirs);
+
+/**
+ * @brief Single-flow-direction accumulation in linear time.
+ *
+ * Cells are processed in topological order (each once all its donors are
+ * done) instead of by repeated sweeps. With several threads the grid is cut
+ * into tiles that are accumulated independently; the flow leaving each tile
+ * is then routed through a small graph of tile-border cells and added back
+ * along the downstream paths inside each receiving tile.
+ *
+ * @param flowDirections Flow-direction codes.
+ * @param[in,out] acc On input each cell's own contribution, on output its
+ *                    accumulation (contribution plus all upstream cells).
+ *                    Cells coded kFlowNoData are left untouched.
+ * @param threads Worker threads (0 = all CPUs).
+ */
+void accumulateFlow(const RasterBuffer<uint8_t>& flowDirections, RasterBuffer<double>& acc, int threads = 0);
+
+/// Reads the elevations of columns [i0, i0 + w) and rows [j0, j0 + h) into z (rows `stride` apart), NaN at nodata.
+typedef std::function<void(int i0, int j0, int w, int h, float* z, size_t stride)> TileReader;
+
+/// Takes the accumulation of columns [i0, i0 + w) and rows [j0, j0 + h), row-major, NaN at nodata.
+typedef std::function<void(int i0, int j0, int w, int h, const float* acc)> TileWriter;
+
+/**
+ * @brief Out-of-core steepest-descent accumulation, a few tiles in memory at a time.
+ *
+ * The scheme of accumulateFlow with tiles that are never all resident:
+ * every tile is read with a two-cell halo, routed and accumulated on its
+ * own, and only its border cells are kept (each linked to the next border
+ * cell downstream). That small graph is solved in memory; every tile is
+ * then read and accumulated again, the flow it receives is added along its
+ * paths and the result is written. Each worker holds one tile, and memory
+ * beyond that grows with the tile perimeters only.
+ *
+ * Directions are those of GeoTiffHandler::flowDirections, except on flats
+ * cut by tile borders. Halo cells are kFlowForeign, so a seam is not an
+ * outlet: a flat drains across it where the neighboring tile continues the
+ * flat to a cell that flows downhill, and a part with no outlet in its own
+ * tile is joined, through the seams, to the nearest part that has one and
+ * leaves through that seam. Every flat that drains in memory drains here,
+ * with directions that may differ near the seams. DEMs without flats (e.g.
+ * epsilon-filled) route exactly as in memory.
+ *
+ * @param width,height Grid size.
+ * @param tileSize Tile edge in cells (at most 65532).
+ * @param dirs Neighbor offsets (i, j); at most 8.
+ * @param cellArea Contribution of every valid cell.
+ * @param read Elevation source; called from several threads at once.
+ * @param write Result sink, once per tile; called from several threads at once.
+ * @param threads Worker threads (0 = all CPUs).
+ */
+void accumulateFlowOutOfCore(int width, int height, int tileSize, const std::vector<std::pair<int,int>>& dirs,
+                             double cellArea, const TileReader& read, const TileWriter& write, int threads = 0);
+
+/**
+ * @brief Multiple-flow-direction (MFD) accumulation in linear time.
+ *
+ * Each valid cell passes its accumulation to all strictly lower neighbors in
+ * proportion to (drop / distance)^exponent. Cells are processed once all
+ * their higher neighbors are done (dependency counting, no sort) and without
+ * per-cell allocation. With several threads the grid is cut into tiles that
+ * are processed in parallel rounds; flow crossing a tile border is handed to
+ * the neighboring tile at the next round.
+ *
+ * @param dem Elevations (NaN = nodata).
+ * @param dirs Neighbor offsets (i, j); at most 8, each with its opposite.
+ * @param exponent Slope exponent of the flow partition.
+ * @param[in,out] acc On input each cell's own contribution, on output its
+ *                    accumulation. Nodata cells are left untouched.
+ * @param threads Worker threads (0 = all CPUs).
+ */
+void accumulateFlowMFD(const RasterBuffer<float>& dem, const std::vector<std::pair<int,int>>& dirs,
+                       double exponent, RasterBuffer<double>& acc, int threads = 0);
+
+/**
+ * @brief D-infinity (Tarboton) flow angles.
+ *
+ * The steepest downslope direction over the eight triangular facets around
+ * each cell, in cell units (square cells assumed). Facets touching the edge
+ * or nodata are skipped.
+ */
+RasterBuffer<float> dinfAngles(const RasterBuffer<float>& dem);
+
+/**
+ * @brief D-infinity accumulation, with the engine of accumulateFlowMFD.
+ *
+ * Each cell passes its accumulation to the two neighbors bracketing its flow
+ * angle, in proportion to how close the angle is to each.
+ *
+ * @param dem Elevations (NaN = nodata).
+ * @param angles dinfAngles(dem).
+ * @param[in,out] acc On input each cell's own contribution, on output its accumulation.
+ * @param threads Worker threads (0 = all CPUs).
+ */
+void accumulateFlowDInf(const RasterBuffer<float>& dem, const RasterBuffer<float>& angles,
+                        RasterBuffer<double>& acc, int threads = 0);
+
+#endif // FLOWDIRECTION_H
@@ -1,4 +1,6 @@
 #include "geotiffhandler.h"
+#include "rasterview.h"
+#include "rastersampler.h"
 #include <stdexcept>
 #include <algorithm>
 #include <utility> // for std::pair
@@ -7,11 +9,18 @@
 #include <iomanip>
 #include <set>       // for visited tracking in drainsToD4
 #include <queue>
+#include <functional> // for std::greater
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include <tuple>
 #include <limits>
 #include <iomanip>
 #include <cmath>
+#include <cstdio>
+#include <type_traits>
 #include "path.h"
+#include "nativeraster.h"
 
 
 static const int di[4] = {  1, -1,  0,  0 };
@@ -24,11 +33,44 @@ static const std::vector<std::pair<int,int>> dirsD8 = {
     {1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,1}, {1,-1}, {-1,-1}
 };
 
+// Cell-center coordinates and cell size from a GDAL geotransform
+static GeoReference geoFromTransform(const double gt[6], int width, int height) {
+    GeoReference geo;
+    geo.dx = gt[1];
+    geo.dy = gt[5]; // typically negative for north-up
+
+    geo.x.resize(width);
+    for (int i = 0; i < width; ++i) geo.x[i] = gt[0] + (i + 0.5) * geo.dx;
+    geo.y.resize(height);
+    for (int j = 0; j < height; ++j) geo.y[j] = gt[3] + (j + 0.5) * geo.dy;
+    return geo;
+}
+
 
 GeoTiffHandler::GeoTiffHandler(const std::string& filename)
+    : GeoTiffHandler(filename, RasterAccessMode::InMemory)
+{
+}
+
+GeoTiffHandler::GeoTiffHandler(const std::string& filename, RasterAccessMode mode, size_t tileCacheBytes)
     : filename_(filename), dataset_(nullptr), width_(0), height_(0), bands_(0),
-    dx_(0.0), dy_(0.0)
+    geo_(std::make_shared<const GeoReference>()),
+    variables_(std::make_shared<VariableMap>())
 {
+    if (NativeRaster::isNativeRaster(filename)) {
+        // Native cache files are mapped, not decoded; the OS pages pixels in
+        // on demand, so there is no need for a tile cache either.
+        NativeRaster native(filename);
+        width_  = native.width();
+        height_ = native.height();
+        bands_  = 1;
+        data_   = native.pixels();
+        GeoReference geo = geoFromTransform(native.geoTransform(), width_, height_);
+        geo.projection = native.projection();
+        setGeo(std::move(geo));
+        return;
+    }
+
     GDALAllRegister();
     dataset_ = (GDALDataset*) GDALOpen(filename.c_str(), GA_ReadOnly);
     if (!dataset_) {
@@ -39,66 +81,90 @@ GeoTiffHandler::GeoTiffHandler(const std::string& filename)
     height_ = dataset_->GetRasterYSize();
     bands_  = dataset_->GetRasterCount();
 
-    // Read first band
-    GDALRasterBand* band = dataset_->GetRasterBand(1);
-    data_.resize(width_ * height_);
-    CPLErr err = band->RasterIO(GF_Read, 0, 0, width_, height_,
-                                data_.data(), width_, height_,
-                                GDT_Float32, 0, 0);
-    if (err != CE_None) {
-        GDALClose(dataset_);
-        throw std::runtime_error("Error reading raster data");
-    }
+    if (mode == RasterAccessMode::Tiled) {
+        // Pixels stay on disk; blocks are read on demand
+        try {
+            tiles_ = std::make_shared<RasterTileCache>(filename, tileCacheBytes);
+        } catch (...) {
+            GDALClose(dataset_);
+            throw;
+        }
+    } else {
+        // Read first band straight into the row-major store, keeping its type
+        GDALRasterBand* band = dataset_->GetRasterBand(1);
+        const PixelType type = pixelTypeFromGDAL(band->GetRasterDataType());
+        int hasNodata = 0;
+        const double nodata = band->GetNoDataValue(&hasNodata);
+        if (hasNodata && type != PixelType::Float32 && type != PixelType::Float64) {
+            data_.setNoData(nodata);
+        }
+        data_.assign(type, width_, height_, 0.0);
+        CPLErr err = band->RasterIO(GF_Read, 0, 0, width_, height_,
+                                    data_.data(), width_, height_,
+                                    toGDALDataType(type), 0, 0);
+        if (err != CE_None) {
+            GDALClose(dataset_);
+            throw std::runtime_error("Error reading raster data");
+        }
 
-    // Fill 2D data
-    data_2d_.resize(width_, std::vector<double>(height_));
-    for (int j = 0; j < height_; ++j) {
-        for (int i = 0; i < width_; ++i) {
-            data_2d_[i][j] = static_cast<double>(data_[j * width_ + i]);
+        // Float nodata becomes NaN, as in Tiled mode; integer nodata is kept and masked
+        if (hasNodata && !data_.hasNoData()) {
+            data_.visit([nodata](auto& b) {
+                using T = typename std::decay_t<decltype(b)>::value_type;
+                if constexpr (std::is_floating_point<T>::value) {
+                    const T nd = static_cast<T>(nodata);
+                    T* v = b.data();
+                    for (size_t k = 0; k < b.size(); ++k) {
+                        if (v[k] == nd) v[k] = std::numeric_limits<T>::quiet_NaN();
+                    }
+                }
+            });
         }
     }
 
     // Extract geotransform for dx, dy and coordinate arrays
+    GeoReference geo;
     double gt[6];
     if (dataset_->GetGeoTransform(gt) == CE_None) {
-        dx_ = gt[1];
-        dy_ = gt[5]; // typically negative for north-up
-
-        x_.resize(width_);
-        for (int i = 0; i < width_; ++i) x_[i] = gt[0] + (i + 0.5) * dx_;
-        y_.resize(height_);
-        for (int j = 0; j < height_; ++j) y_[j] = gt[3] + (j + 0.5) * dy_;
+        geo = geoFromTransform(gt, width_, height_);
     }
+    const char* proj = dataset_->GetProjectionRef();
+    if (proj) geo.projection = proj;
+    setGeo(std::move(geo));
 }
 
 GeoTiffHandler::GeoTiffHandler(int width, int height)
     : filename_(""), dataset_(nullptr),
     width_(width), height_(height), bands_(1),
-    dx_(0.0), dy_(0.0)
+    geo_(std::make_shared<const GeoReference>()),
+    variables_(std::make_shared<VariableMap>())
 {
     GDALAllRegister();
-    data_.resize(width * height, 0.0f);
-    data_2d_.assign(width, std::vector<double>(height, 0.0));
+    data_.assign(PixelType::Float32, width, height, 0.0);
 }
 
 GeoTiffHandler::GeoTiffHandler()
     : filename_(""), dataset_(nullptr),
     width_(1), height_(1), bands_(1),
-    dx_(0.0), dy_(0.0)
+    geo_(std::make_shared<const GeoReference>()),
+    variables_(std::make_shared<VariableMap>())
 {
     GDALAllRegister();
-    data_.resize(1 * 1, 0.0f);
-    data_2d_.assign(1, std::vector<double>(1, 0.0));
+    data_.assign(PixelType::Float32, 1, 1, 0.0);
 }
 
 
-// Copy constructor
+// Copy constructor: shares pixels, variables and geo-referencing (copy-on-write)
 GeoTiffHandler::GeoTiffHandler(const GeoTiffHandler& other)
     : filename_(""), dataset_(nullptr),
     width_(other.width_), height_(other.height_), bands_(other.bands_),
-    data_(other.data_), data_2d_(other.data_2d_),
-    x_(other.x_), y_(other.y_),
-    dx_(other.dx_), dy_(other.dy_),
+    data_(other.data_),
+    validity_(std::atomic_load(&other.validity_)),
+    flowDirs_{std::atomic_load(&other.flowDirs_[0]), std::atomic_load(&other.flowDirs_[1])},
+    inflow_{std::atomic_load(&other.inflow_[0]), std::atomic_load(&other.inflow_[1])},
+    flowAngles_(std::atomic_load(&other.flowAngles_)),
+    tiles_(other.tiles_),
+    geo_(other.geo_),
     variables_(other.variables_)
 {
     // dataset_ deliberately left null (we do not duplicate GDAL handles)
@@ -113,11 +179,14 @@ GeoTiffHandler& GeoTiffHandler::operator=(const GeoTiffHandler& other) {
         height_  = other.height_;
         bands_   = other.bands_;
         data_    = other.data_;
-        data_2d_ = other.data_2d_;
-        x_       = other.x_;
-        y_       = other.y_;
-        dx_      = other.dx_;
-        dy_      = other.dy_;
+        validity_ = std::atomic_load(&other.validity_);
+        flowDirs_[0] = std::atomic_load(&other.flowDirs_[0]);
+        flowDirs_[1] = std::atomic_load(&other.flowDirs_[1]);
+        inflow_[0] = std::atomic_load(&other.inflow_[0]);
+        inflow_[1] = std::atomic_load(&other.inflow_[1]);
+        flowAngles_ = std::atomic_load(&other.flowAngles_);
+        tiles_   = other.tiles_;
+        geo_     = other.geo_;
         variables_ = other.variables_;
     }
     return *this;
@@ -133,62 +202,188 @@ GeoTiffHandler::~GeoTiffHandler() {
 int GeoTiffHandler::width() const { return width_; }
 int GeoTiffHandler::height() const { return height_; }
 int GeoTiffHandler::bands() const { return bands_; }
-const std::vector<float>& GeoTiffHandler::data1D() const { return data_; }
-const std::vector<std::vector<double>>& GeoTiffHandler::data2D() const { return data_2d_; }
+bool GeoTiffHandler::isTiled() const { return tiles_ != nullptr; }
+PixelType GeoTiffHandler::pixelType() const { return tiles_ ? PixelType::Float32 : data_.type(); }
+
+const float* GeoTiffHandler::data1D() const {
+    requireInMemory("data1D");
+    return data_.as<float>().data();
+}
+
+RasterSpan<const float> GeoTiffHandler::data2D() const {
+    requireInMemory("data2D");
+    return data_.as<float>().span();
+}
+
+const PixelBuffer& GeoTiffHandler::pixels() const {
+    requireInMemory("pixels");
+    return data_;
+}
+
+GeoTiffHandler GeoTiffHandler::convertedTo(PixelType type) const {
+    requireInMemory("convertedTo");
+    GeoTiffHandler out(*this);
+    out.setPixels(data_.converted(type));
+    return out;
+}
+
+const ValidityMask& GeoTiffHandler::validity() const {
+    requireInMemory("validity");
+    std::shared_ptr<const ValidityMask> mask = std::atomic_load(&validity_);
+    if (!mask) {
+        // Built on first use; if concurrent first calls both build, every caller
+        // returns the one published first, which validity_ keeps alive
+        mask = std::make_shared<const ValidityMask>(ValidityMask::fromPixels(data_));
+        std::shared_ptr<const ValidityMask> none;
+        if (!std::atomic_compare_exchange_strong(&validity_, &none, mask)) mask = none;
+    }
+    return *mask;
+}
+
+void GeoTiffHandler::setPixels(PixelBuffer pixels) {
+    data_ = std::move(pixels);
+    dropDerivedCaches();
+}
+
+PixelBuffer& GeoTiffHandler::mutablePixels() {
+    dropDerivedCaches();
+    return data_;
+}
+
+void GeoTiffHandler::dropDerivedCaches() {
+    std::atomic_store(&validity_, std::shared_ptr<const ValidityMask>());
+    std::atomic_store(&flowDirs_[0], std::shared_ptr<const RasterBuffer<uint8_t>>());
+    std::atomic_store(&flowDirs_[1], std::shared_ptr<const RasterBuffer<uint8_t>>());
+    std::atomic_store(&inflow_[0], std::shared_ptr<const InflowIndex>());
+    std::atomic_store(&inflow_[1], std::shared_ptr<const InflowIndex>());
+    std::atomic_store(&flowAngles_, std::shared_ptr<const RasterBuffer<float>>());
+}
+
+double GeoTiffHandler::cellValue(int i, int j) const {
+    return tiles_ ? tiles_->value(i, j) : data_.value(i, j);
+}
+
+RasterBuffer<float> GeoTiffHandler::neighborhood(int i, int j, int radius) const {
+    if (tiles_) {
+        return tiles_->neighborhood(i, j, radius);
+    }
+    const int n = 2 * radius + 1;
+    RasterBuffer<float> out(n, n, std::nanf(""));
+    for (int dj = -radius; dj <= radius; ++dj) {
+        int nj = j + dj;
+        if (nj < 0 || nj >= height_) continue;
+        for (int di = -radius; di <= radius; ++di) {
+            int ni = i + di;
+            if (ni < 0 || ni >= width_) continue;
+            out(di + radius, dj + radius) = static_cast<float>(data_.value(ni, nj));
+        }
+    }
+    return out;
+}
+
+const RasterTileCache* GeoTiffHandler::tileCache() const { return tiles_.get(); }
+
+void GeoTiffHandler::setTileCacheBudget(size_t bytes) {
+    if (tiles_) tiles_->setMemoryBudget(bytes);
+}
+
+void GeoTiffHandler::requireInMemory(const char* operation) const {
+    if (tiles_) {
+        throw std::runtime_error(std::string("GeoTiffHandler::") + operation +
+                                 " needs the whole raster in memory; open it with RasterAccessMode::InMemory.");
+    }
+}
+
+template <typename Fn>
+void GeoTiffHandler::forEachRowSegment(Fn&& fn) const {
+    if (!tiles_) {
+        const RasterBuffer<float> pixels = data_.toFloat();  // shared unless stored narrower
+        for (int j = 0; j < height_; ++j) {
+            fn(j, 0, pixels.row(j), width_);
+        }
+        return;
+    }
+    for (auto it = tiles_->begin(); it != tiles_->end(); ++it) {
+        std::shared_ptr<const RasterTile> t = *it;
+        for (int r = 0; r < t->height; ++r) {
+            fn(t->j0 + r, t->i0, t->values.data() + static_cast<size_t>(r) * t->width, t->width);
+        }
+    }
+}
 
 float GeoTiffHandler::minValue() const {
-    return *std::min_element(data_.begin(), data_.end());
+    return static_cast<float>(statistics().min);
 }
 
 float GeoTiffHandler::maxValue() const {
-    return *std::max_element(data_.begin(), data_.end());
+    return static_cast<float>(statistics().max);
+}
+
+RasterStatistics GeoTiffHandler::statistics() const {
+    RasterStatistics stats;
+    forEachRowSegment([&](int j, int i0, const float* row, int n) {
+        stats.add(rowStatistics(row, n), i0, j);
+    });
+    return stats;
 }
 
 double GeoTiffHandler::getGeoTransform(int idx) const {
-    double gt[6];
-    if (dataset_->GetGeoTransform(gt) == CE_None) {
-        return gt[idx];
+    if (geo_->x.empty() || geo_->y.empty() || idx < 0 || idx > 5) {
+        throw std::runtime_error("Failed to get GeoTransform");
     }
-    throw std::runtime_error("Failed to get GeoTransform");
+    const double gt[6] = {
+        geo_->x.front() - 0.5 * geo_->dx, geo_->dx, 0.0,
+        geo_->y.front() - 0.5 * geo_->dy, 0.0, geo_->dy
+    };
+    return gt[idx];
 }
 
-void GeoTiffHandler::normalize() {
-    float minVal = minValue();
-    float maxVal = maxValue();
-    for (auto& v : data_) {
-        v = (v - minVal) / (maxVal - minVal);
-    }
-    for (int j = 0; j < height_; ++j) {
-        for (int i = 0; i < width_; ++i) {
-            data_2d_[i][j] = (data_2d_[i][j] - minVal) / (maxVal - minVal);
-        }
+const std::string& GeoTiffHandler::projection() const { return geo_->projection; }
+
+void GeoTiffHandler::setGeo(GeoReference geo) {
+    geo_ = std::make_shared<const GeoReference>(std::move(geo));
+}
+
+GeoTiffHandler::VariableMap& GeoTiffHandler::mutableVariables() {
+    if (variables_.use_count() > 1) {
+        variables_ = std::make_shared<VariableMap>(*variables_);
     }
+    return *variables_;
+}
+
+void GeoTiffHandler::normalize() {
+    requireInMemory("normalize");
+    const RasterStatistics stats = statistics();
+    const float minVal = static_cast<float>(stats.min);
+    const float maxVal = static_cast<float>(stats.max);
+    setPixels(data_.converted(PixelType::Float32));  // normalized values are fractional
+    normalizeKernel(mutablePixels().as<float>().data(), data_.size(), minVal, maxVal - minVal);
 }
 
 // ---- Getters and setters ----
-const std::vector<double>& GeoTiffHandler::x() const { return x_; }
-void GeoTiffHandler::setX(const std::vector<double>& x) { x_ = x; }
+const std::vector<double>& GeoTiffHandler::x() const { return geo_->x; }
+void GeoTiffHandler::setX(const std::vector<double>& x) { GeoReference g = *geo_; g.x = x; setGeo(std::move(g)); }
 
-const std::vector<double>& GeoTiffHandler::y() const { return y_; }
-void GeoTiffHandler::setY(const std::vector<double>& y) { y_ = y; }
+const std::vector<double>& GeoTiffHandler::y() const { return geo_->y; }
+void GeoTiffHandler::setY(const std::vector<double>& y) { GeoReference g = *geo_; g.y = y; setGeo(std::move(g)); }
 
-double GeoTiffHandler::dx() const { return dx_; }
-void GeoTiffHandler::setDx(double dx) { dx_ = dx; }
+double GeoTiffHandler::dx() const { return geo_->dx; }
+void GeoTiffHandler::setDx(double dx) { GeoReference g = *geo_; g.dx = dx; setGeo(std::move(g)); }
 
-double GeoTiffHandler::dy() const { return dy_; }
-void GeoTiffHandler::setDy(double dy) { dy_ = dy; }
+double GeoTiffHandler::dy() const { return geo_->dy; }
+void GeoTiffHandler::setDy(double dy) { GeoReference g = *geo_; g.dy = dy; setGeo(std::move(g)); }
 
 
 double GeoTiffHandler::valueAt(double xCoord, double yCoord) const {
-    if (x_.empty() || y_.empty()) {
+    if (geo_->x.empty() || geo_->y.empty()) {
         return std::nan("");
     }
 
-    double col = (xCoord - (x_.front())) / dx_;
-    double row = (yCoord - (y_.front())) / dy_;
+    double col = (xCoord - (geo_->x.front())) / geo_->dx;
+    double row = (yCoord - (geo_->y.front())) / geo_->dy;
 
-    if (dy_ < 0) {
-        row = (yCoord - y_.front()) / dy_;
+    if (geo_->dy < 0) {
+        row = (yCoord - geo_->y.front()) / geo_->dy;
     }
 
     // Return NaN if outside bounds
@@ -202,10 +397,10 @@ double GeoTiffHandler::valueAt(double xCoord, double yCoord) const {
     double dxFrac = col - i;
     double dyFrac = row - j;
 
-    double q11 = data_2d_[i][j];
-    double q21 = data_2d_[i+1][j];
-    double q12 = data_2d_[i][j+1];
-    double q22 = data_2d_[i+1][j+1];
+    double q11 = cellValue(i, j);
+    double q21 = cellValue(i+1, j);
+    double q12 = cellValue(i, j+1);
+    double q22 = cellValue(i+1, j+1);
 
     // Return NaN if any corner is NaN
     if (std::isnan(q11) || std::isnan(q21) || std::isnan(q12) || std::isnan(q22)) {
@@ -222,8 +417,18 @@ double GeoTiffHandler::valueAt(double xCoord, double yCoord) const {
     return val;
 }
 
+std::vector<double> GeoTiffHandler::valuesAt(const std::vector<double>& xs, const std::vector<double>& ys, int threads) const {
+    return RasterSampler(*this, threads).values(xs, ys);
+}
+
+std::vector<std::pair<double,double>> GeoTiffHandler::slopesAtBilinear(const std::vector<double>& xs,
+                                                                       const std::vector<double>& ys,
+                                                                       int threads) const {
+    return RasterSampler(*this, threads).slopes(xs, ys);
+}
+
 GeoTiffHandler GeoTiffHandler::resample(int newNx, int newNy) const {
-    if (x_.empty() || y_.empty()) {
+    if (geo_->x.empty() || geo_->y.empty()) {
         throw std::runtime_error("Coordinate arrays not initialized.");
     }
     if (newNx <= 1 || newNy <= 1) {
@@ -232,59 +437,160 @@ GeoTiffHandler GeoTiffHandler::resample(int newNx, int newNy) const {
 
     // Create a "blank" handler without using GDAL file — private constructor trick
     GeoTiffHandler out(*this);  // copy metadata
+    out.tiles_.reset();         // result lives in memory even if the source is tiled
     out.width_  = newNx;
     out.height_ = newNy;
 
     // Recompute dx, dy
-    double xmin = x_.front();
-    double xmax = x_.back();
-    double ymin = (dy_ > 0) ? y_.front() : y_.back();
-    double ymax = (dy_ > 0) ? y_.back() : y_.front();
+    double xmin = geo_->x.front();
+    double xmax = geo_->x.back();
+    double ymin = (geo_->dy > 0) ? geo_->y.front() : geo_->y.back();
+    double ymax = (geo_->dy > 0) ? geo_->y.back() : geo_->y.front();
 
-    out.dx_ = (xmax - xmin) / (newNx - 1);
-    out.dy_ = (ymax - ymin) / (newNy - 1);
-    if (dy_ < 0) out.dy_ = -out.dy_;
+    GeoReference g;
+    g.projection = geo_->projection;
+    g.dx = (xmax - xmin) / (newNx - 1);
+    g.dy = (ymax - ymin) / (newNy - 1);
+    if (geo_->dy < 0) g.dy = -g.dy;
 
     // New coordinate vectors
-    out.x_.resize(newNx);
-    out.y_.resize(newNy);
+    g.x.resize(newNx);
+    g.y.resize(newNy);
     for (int i = 0; i < newNx; ++i) {
-        out.x_[i] = xmin + i * out.dx_;
+        g.x[i] = xmin + i * g.dx;
     }
     for (int j = 0; j < newNy; ++j) {
-        if (dy_ < 0) {
-            out.y_[j] = ymax + j * out.dy_;  // Start from ymax for north-up rasters
+        if (geo_->dy < 0) {
+            g.y[j] = ymax + j * g.dy;  // Start from ymax for north-up rasters
         } else {
-            out.y_[j] = ymin + j * out.dy_;  // Start from ymin for south-up rasters
+            g.y[j] = ymin + j * g.dy;  // Start from ymin for south-up rasters
         }
     }
 
-    // Allocate new 2D data
-    out.data_2d_.assign(newNx, std::vector<double>(newNy, 0.0));
-
     // Fill with interpolated values
+    RasterBuffer<float> resampled(newNx, newNy, 0.0f);
     for (int j = 0; j < newNy; ++j) {
+        float* row = resampled.row(j);
         for (int i = 0; i < newNx; ++i) {
-            out.data_2d_[i][j] = valueAt(out.x_[i], out.y_[j]);
+            row[i] = static_cast<float>(valueAt(g.x[i], g.y[j]));
         }
     }
+    out.setPixels(std::move(resampled));
+    out.setGeo(std::move(g));
 
-    // Flatten into 1D for consistency
-    out.data_.resize(newNx * newNy);
-    for (int j = 0; j < newNy; ++j) {
-        for (int i = 0; i < newNx; ++i) {
-            out.data_[j * newNx + i] = static_cast<float>(out.data_2d_[i][j]);
+    return out;
+}
+
+// GDAL creation options for a GTiff or COG written with the given options
+static char** creationOptions(const GeoTiffWriteOptions& options, PixelType type, bool cog) {
+    char** opts = nullptr;
+    if (options.compression != GeoTiffWriteOptions::Compression::None) {
+        const char* method = "DEFLATE";
+        if (options.compression == GeoTiffWriteOptions::Compression::Zstd) method = "ZSTD";
+        if (options.compression == GeoTiffWriteOptions::Compression::Lzw)  method = "LZW";
+        opts = CSLSetNameValue(opts, "COMPRESS", method);
+
+        if (options.predictor) {
+            const bool isFloat = (type == PixelType::Float32 || type == PixelType::Float64);
+            // COG spells predictors by name, GTiff by number
+            if (cog) opts = CSLSetNameValue(opts, "PREDICTOR", isFloat ? "FLOATING_POINT" : "STANDARD");
+            else     opts = CSLSetNameValue(opts, "PREDICTOR", isFloat ? "3" : "2");
         }
-    }
+        // LZW has no level; GDAL would silently ignore one
+        if (options.level > 0 && options.compression != GeoTiffWriteOptions::Compression::Lzw) {
+            const std::string level = std::to_string(options.level);
+            if (cog) opts = CSLSetNameValue(opts, "LEVEL", level.c_str());
+            else opts = CSLSetNameValue(opts, options.compression == GeoTiffWriteOptions::Compression::Zstd
+                                              ? "ZSTD_LEVEL" : "ZLEVEL", level.c_str());
+        }
+        const std::string threads = options.threads > 0 ? std::to_string(options.threads) : "ALL_CPUS";
+        opts = CSLSetNameValue(opts, "NUM_THREADS", threads.c_str());
+        opts = CSLSetNameValue(opts, "BIGTIFF", "IF_SAFER");
+    }
+
+    const std::string block = std::to_string(options.blockSize);
+    if (cog) {
+        opts = CSLSetNameValue(opts, "BLOCKSIZE", block.c_str());
+        opts = CSLSetNameValue(opts, "OVERVIEWS", options.overviews ? "AUTO" : "NONE");
+        opts = CSLSetNameValue(opts, "OVERVIEW_RESAMPLING", "AVERAGE");
+    } else if (options.tiled) {
+        opts = CSLSetNameValue(opts, "TILED", "YES");
+        opts = CSLSetNameValue(opts, "BLOCKXSIZE", block.c_str());
+        opts = CSLSetNameValue(opts, "BLOCKYSIZE", block.c_str());
+        opts = CSLSetNameValue(opts, "SPARSE_OK", "TRUE");
+    }
+    return opts;
+}
 
-    return out;
+void GeoTiffHandler::saveAs(const std::string& filename, RasterFormat format) const {
+    if (format == RasterFormat::Native) {
+        requireInMemory("saveAs");
+        if (data_.empty() || geo_->x.empty() || geo_->y.empty()) {
+            throw std::runtime_error("No data or coordinate arrays available to save.");
+        }
+        double gt[6];
+        for (int k = 0; k < 6; ++k) gt[k] = getGeoTransform(k);
+        NativeRaster::write(filename, data_, gt, geo_->projection);
+        return;
+    }
+    saveAs(filename, GeoTiffWriteOptions());
 }
 
-void GeoTiffHandler::saveAs(const std::string& filename) const {
-    if (data_2d_.empty() || x_.empty() || y_.empty()) {
+void GeoTiffHandler::saveAs(const std::string& filename, const GeoTiffWriteOptions& options) const {
+    requireInMemory("saveAs");
+    if (data_.empty() || geo_->x.empty() || geo_->y.empty()) {
         throw std::runtime_error("No data or coordinate arrays available to save.");
     }
 
+    const GDALDataType gdalType = toGDALDataType(data_.type());
+    double gt[6];
+    for (int k = 0; k < 6; ++k) gt[k] = getGeoTransform(k);
+
+    // Declared nodata: the stored integer nodata, or NaN for float rasters with gaps
+    bool hasNodata = data_.hasNoData();
+    double nodata = data_.noData();
+    if (!hasNodata && (data_.type() == PixelType::Float32 || data_.type() == PixelType::Float64) &&
+        !validity().allValid()) {
+        hasNodata = true;
+        nodata = std::nan("");
+    }
+
+    if (options.cloudOptimized) {
+        GDALDriver* cogDriver = GetGDALDriverManager()->GetDriverByName("COG");
+        GDALDriver* memDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+        if (!cogDriver || !memDriver) {
+            throw std::runtime_error("COG output needs the COG and MEM drivers (GDAL 3.1 or newer).");
+        }
+
+        // MEM dataset wrapping the pixel store, so the COG driver reads it in place
+        GDALDataset* src = memDriver->Create("", width_, height_, 0, gdalType, nullptr);
+        if (!src) {
+            throw std::runtime_error("Failed to create in-memory source for " + filename);
+        }
+        char pointer[64];
+        std::snprintf(pointer, sizeof(pointer), "%p", const_cast<void*>(data_.data()));
+        char** bandOpts = CSLSetNameValue(nullptr, "DATAPOINTER", pointer);
+        CPLErr err = src->AddBand(gdalType, bandOpts);
+        CSLDestroy(bandOpts);
+        if (err != CE_None) {
+            GDALClose(src);
+            throw std::runtime_error("Failed to wrap raster data for " + filename);
+        }
+        src->SetGeoTransform(gt);
+        if (!geo_->projection.empty()) src->SetProjection(geo_->projection.c_str());
+        if (hasNodata) src->GetRasterBand(1)->SetNoDataValue(nodata);
+
+        char** opts = creationOptions(options, data_.type(), true);
+        GDALDataset* outDs = cogDriver->CreateCopy(filename.c_str(), src, /*bStrict=*/ 0, opts, nullptr, nullptr);
+        CSLDestroy(opts);
+        GDALClose(src);
+        if (!outDs) {
+            throw std::runtime_error("Failed to create output COG: " + filename);
+        }
+        GDALClose(outDs);
+        return;
+    }
+
     // Get GDAL driver for GeoTIFF
     GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
     if (!driver) {
@@ -292,81 +598,80 @@ void GeoTiffHandler::saveAs(const std::string& filename) const {
     }
 
     // Create output dataset
+    char** opts = creationOptions(options, data_.type(), false);
     GDALDataset* outDs = driver->Create(
         filename.c_str(),
         width_, height_, 1,  // cols, rows, bands
-        GDT_Float32,
-        nullptr
+        gdalType,
+        opts
         );
+    CSLDestroy(opts);
     if (!outDs) {
         throw std::runtime_error("Failed to create output GeoTIFF: " + filename);
     }
 
-    // Construct geotransform
-    double gt[6] = {0};
-    gt[0] = x_.front() - 0.5 * dx_;  // top-left corner x
-    gt[1] = dx_;
-    gt[2] = 0.0;
-    gt[3] = y_.front() - 0.5 * dy_;  // top-left corner y (note: dy may be negative)
-    gt[4] = 0.0;
-    gt[5] = dy_;
     outDs->SetGeoTransform(gt);
 
-
     // Copy projection if available
-    if (dataset_) {
-        const char* proj = dataset_->GetProjectionRef();
-        if (proj && strlen(proj) > 0) {
-            outDs->SetProjection(proj);
-        }
+    if (!geo_->projection.empty()) {
+        outDs->SetProjection(geo_->projection.c_str());
     }
 
-    // Flatten data_2d into row-major order for writing
-    std::vector<float> buffer(width_ * height_);
-    for (int j = 0; j < height_; ++j) {
-        for (int i = 0; i < width_; ++i) {
-            buffer[j * width_ + i] = static_cast<float>(data_2d_[i][j]);
-        }
-    }
-
-    // Write data
+    // Write data in its own type (the store is already row-major, so no staging copy)
     GDALRasterBand* band = outDs->GetRasterBand(1);
+    if (hasNodata) {
+        band->SetNoDataValue(nodata);
+    }
     CPLErr err = band->RasterIO(GF_Write, 0, 0, width_, height_,
-                                buffer.data(), width_, height_,
-                                GDT_Float32, 0, 0);
+                                const_cast<void*>(data_.data()), width_, height_,
+                                gdalType, 0, 0);
     if (err != CE_None) {
         GDALClose(outDs);
         throw std::runtime_error("Error writing raster data to " + filename);
     }
 
+    if (options.overviews) {
+        // Halve until the coarsest level fits in one block
+        std::vector<int> levels;
+        for (int f = 2; std::max(width_, height_) / (f / 2) > options.blockSize; f *= 2) {
+            levels.push_back(f);
+        }
+        if (!levels.empty() &&
+            outDs->BuildOverviews("AVERAGE", static_cast<int>(levels.size()), levels.data(),
+                                  0, nullptr, nullptr, nullptr) != CE_None) {
+            GDALClose(outDs);
+            throw std::runtime_error("Error building overviews for " + filename);
+        }
+    }
+
     GDALClose(outDs);
 }
 
 std::pair<int,int> GeoTiffHandler::indicesAt(double xCoord, double yCoord) const {
-    if (x_.empty() || y_.empty()) {
+    if (geo_->x.empty() || geo_->y.empty()) {
         throw std::runtime_error("Coordinate arrays not initialized.");
     }
 
     // --- Check bounds ---
-    double xmin = x_.front();
-    double xmax = x_.back();
+    double xmin = geo_->x.front();
+    double xmax = geo_->x.back();
     if (xmin > xmax) std::swap(xmin, xmax);
 
-    double ymin = std::min(y_.front(), y_.back());
-    double ymax = std::max(y_.front(), y_.back());
+    double ymin = std::min(geo_->y.front(), geo_->y.back());
+    double ymax = std::max(geo_->y.front(), geo_->y.back());
 
     if (xCoord < xmin || xCoord > xmax || yCoord < ymin || yCoord > ymax) {
         throw std::out_of_range("Requested coordinate is outside raster extent.");
     }
 
     // --- Nearest column index ---
-    double col = (xCoord - x_.front()) / dx_;   // dx_ may be negative
+    double col = (xCoord - geo_->x.front()) / geo_->dx;   // geo_->dx may be negative
     int i = static_cast<int>(std::round(col));
     if (i < 0) i = 0;
     if (i >= width_) i = width_ - 1;
 
     // --- Nearest row index ---
-    double row = (yCoord - y_.front()) / dy_;   // dy_ may be negative
+    double row = (yCoord - geo_->y.front()) / geo_->dy;   // geo_->dy may be negative
     int j = static_cast<int>(std::round(row));
     if (j < 0) j = 0;
     if (j >= height_) j = height_ - 1;
@@ -376,7 +681,8 @@ std::pair<int,int> GeoTiffHandler::indicesAt(double xCoord, double yCoord) const
 
 
 void GeoTiffHandler::saveAsAscii(const std::string& filename, double nodata) const {
-    if (data_2d_.empty() || x_.empty() || y_.empty())
+    requireInMemory("saveAsAscii");
+    if (data_.empty() || geo_->x.empty() || geo_->y.empty())
         throw std::runtime_error("No data to save to ASCII.");
 
     std::ofstream out(filename, std::ios::out);
@@ -385,16 +691,18 @@ void GeoTiffHandler::saveAsAscii(const std::string& filename, double nodata) con
 
     out << "ncols " << width_ << "\n";
     out << "nrows " << height_ << "\n";
-    out << "xllcorner " << (x_.front() - dx_ / 2.0) << "\n";
-    out << "yllcorner " << (*std::min_element(y_.begin(), y_.end()) - std::abs(dy_) / 2.0) << "\n";
-    out << "dx " << dx_ << "\n";
-    out << "dy " << dy_ << "\n";
+    out << "xllcorner " << (geo_->x.front() - geo_->dx / 2.0) << "\n";
+    out << "yllcorner " << (*std::min_element(geo_->y.begin(), geo_->y.end()) - std::abs(geo_->dy) / 2.0) << "\n";
+    out << "dx " << geo_->dx << "\n";
+    out << "dy " << geo_->dy << "\n";
     out << "NODATA_value " << nodata << "\n";
 
     out << std::fixed << std::setprecision(10);
+    const RasterBuffer<float> pixels = data_.toFloat();
     for (int j = height_ - 1; j >= 0; --j) {
+        const float* row = pixels.row(j);
         for (int i = 0; i < width_; ++i) {
-            double v = data_2d_[i][j];
+            double v = row[i];
             out << (std::isnan(v) ? nodata : v);
             if (i < width_ - 1) out << " ";
         }
@@ -417,253 +725,330 @@ void GeoTiffHandler::loadFromAscii(const std::string& filename) {
     in >> key >> yll;
     in >> key >> cellsize;
     in >> key >> nodata;
+    tiles_.reset();
 
-    dx_ = cellsize;
-    dy_ = -cellsize; // north-up assumption
+    GeoReference g;
+    g.dx = cellsize;
+    g.dy = -cellsize; // north-up assumption
     bands_ = 1;
 
     // Build coordinate arrays as cell centers
-    x_.resize(width_);
-    y_.resize(height_);
+    g.x.resize(width_);
+    g.y.resize(height_);
     for (int i = 0; i < width_; ++i)
-        x_[i] = xll + (i + 0.5) * dx_;
+        g.x[i] = xll + (i + 0.5) * g.dx;
     for (int j = 0; j < height_; ++j)
-        y_[j] = yll + (j + 0.5) * std::abs(dy_);
+        g.y[j] = yll + (j + 0.5) * std::abs(g.dy);
+    setGeo(std::move(g));
 
     // Allocate storage
-    data_2d_.assign(width_, std::vector<double>(height_, nodata));
-    data_.resize(width_ * height_);
+    RasterBuffer<float> pixels(width_, height_, static_cast<float>(nodata));
 
     // Read values top → bottom
     for (int j = height_ - 1; j >= 0; --j) {
+        float* row = pixels.row(j);
         for (int i = 0; i < width_; ++i) {
             double v;
             in >> v;
             if (!in) throw std::runtime_error("Error reading data from ASCII grid.");
-            data_2d_[i][j] = (v == nodata ? std::nan("") : v);
-            data_[j * width_ + i] = static_cast<float>(data_2d_[i][j]);
+            row[i] = (v == nodata ? std::nanf("") : static_cast<float>(v));
         }
     }
+    setPixels(std::move(pixels));
 }
 
 
-std::pair<int,int> GeoTiffHandler::downslope(int i, int j, FlowDirType type) const {
+const RasterBuffer<uint8_t>& GeoTiffHandler::flowDirections(FlowDirType type) const {
+    std::shared_ptr<const RasterBuffer<uint8_t>>& slot = flowDirs_[type == FlowDirType::D4 ? 0 : 1];
+    std::shared_ptr<const RasterBuffer<uint8_t>> cached = std::atomic_load(&slot);
+    if (cached) return *cached;
+
+    // Built on first use; if concurrent first calls both build, every caller
+    // returns the layer published first, which the slot keeps alive
     const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    std::vector<uint8_t> codes(dirs.size());
+    for (size_t d = 0; d < dirs.size(); ++d) codes[d] = flowCode(dirs[d].first, dirs[d].second);
 
-    double z = data_2d_[i][j];
-    int bestI = -1, bestJ = -1;
-    double maxDrop = 0.0;
+    const bool direct = !tiles_ && data_.type() == PixelType::Float32;
+    const RasterSpan<const float> pixels = direct ? data_.as<float>().span() : RasterSpan<const float>();
+    auto z = [&](int i, int j) -> double { return direct ? pixels(i, j) : cellValue(i, j); };
 
-    for (auto [di,dj] : dirs) {
-        int ni = i + di;
-        int nj = j + dj;
-        if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
+    auto layer = std::make_shared<RasterBuffer<uint8_t>>(width_, height_, kFlowNone);
+    RasterBuffer<uint8_t> equal(width_, height_, 0);  // bit d: neighbor d has the same elevation
+    uint8_t* out = layer->data();
+    bool flats = false;
+    for (int j = 0; j < height_; ++j) {
+        for (int i = 0; i < width_; ++i) {
+            const double zc = z(i, j);
+            if (std::isnan(zc)) {
+                out[layer->index(i, j)] = kFlowNoData;
+                continue;
+            }
+            uint8_t best = kFlowNone;
+            uint8_t same = 0;
+            double maxDrop = 0.0;
+            for (size_t d = 0; d < dirs.size(); ++d) {
+                const int ni = i + dirs[d].first;
+                const int nj = j + dirs[d].second;
+                if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
+
+                const double dz = zc - z(ni, nj);
+                if (dz > maxDrop) {
+                    maxDrop = dz;
+                    best = codes[d];
+                } else if (dz == 0.0) {
+                    same |= static_cast<uint8_t>(1u << d);
+                }
+            }
+            out[layer->index(i, j)] = best;
+            equal(i, j) = same;
+            flats = flats || (best == kFlowNone && same != 0);
+        }
+    }
+    if (flats) resolveFlats(*layer, equal, dirs);
+
+    cached = layer;
+    std::shared_ptr<const RasterBuffer<uint8_t>> none;
+    if (!std::atomic_compare_exchange_strong(&slot, &none, cached)) cached = none;
+    return *cached;
+}
+
+GeoTiffHandler GeoTiffHandler::flowDirectionRaster(FlowDirType type) const {
+    GeoTiffHandler out(width_, height_);
+    out.geo_ = geo_;
+    PixelBuffer codes(flowDirections(type));
+    codes.setNoData(kFlowNoData);
+    out.setPixels(std::move(codes));
+    return out;
+}
+
+const RasterBuffer<float>& GeoTiffHandler::flowAnglesDInf() const {
+    requireInMemory("flowAnglesDInf");
+    std::shared_ptr<const RasterBuffer<float>> cached = std::atomic_load(&flowAngles_);
+    if (!cached) {
+        // Concurrent first builds: every caller returns the angles published first
+        cached = std::make_shared<const RasterBuffer<float>>(dinfAngles(data_.toFloat()));
+        std::shared_ptr<const RasterBuffer<float>> none;
+        if (!std::atomic_compare_exchange_strong(&flowAngles_, &none, cached)) cached = none;
+    }
+    return *cached;
+}
+
+GeoTiffHandler GeoTiffHandler::flowAngleRasterDInf() const {
+    GeoTiffHandler out(width_, height_);
+    out.geo_ = geo_;
+    out.setPixels(flowAnglesDInf());
+    return out;
+}
+
+GeoTiffHandler GeoTiffHandler::flowAccumulationDInf(int threads) const {
+    const RasterBuffer<float>& angles = flowAnglesDInf();
+
+    RasterBuffer<double> acc(width_, height_, fabs(geo_->dx)*fabs(geo_->dy));
+    const RasterBuffer<float> dem = data_.toFloat();
+    accumulateFlowDInf(dem, angles, acc, threads);
+
+    RasterBuffer<float> accumulation(width_, height_);
+    float* o = accumulation.data();
+    for (size_t k = 0; k < acc.size(); ++k) {
+        o[k] = std::isnan(dem.data()[k]) ? std::nanf("") : static_cast<float>(acc.data()[k]);
+    }
+    GeoTiffHandler out(width_, height_);
+    out.geo_ = geo_;
+    out.setPixels(std::move(accumulation));
+    return out;
+}
+
+const InflowIndex& GeoTiffHandler::inflowIndex(FlowDirType type) const {
+    std::shared_ptr<const InflowIndex>& slot = inflow_[type == FlowDirType::D4 ? 0 : 1];
+    std::shared_ptr<const InflowIndex> cached = std::atomic_load(&slot);
+    if (!cached) {
+        // Concurrent first builds: every caller returns the index published first
+        cached = std::make_shared<const InflowIndex>(flowDirections(type));
+        std::shared_ptr<const InflowIndex> none;
+        if (!std::atomic_compare_exchange_strong(&slot, &none, cached)) cached = none;
+    }
+    return *cached;
+}
 
-        double dz = z - data_2d_[ni][nj];
+uint8_t GeoTiffHandler::neighborFlowCode(int i, int j, FlowDirType type) const {
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    const double z = cellValue(i, j);
+    if (std::isnan(z)) return kFlowNoData;
+    uint8_t best = kFlowNone;
+    double maxDrop = 0.0;
+    for (auto [di, dj] : dirs) {
+        const int ni = i + di, nj = j + dj;
+        if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
+        const double dz = z - cellValue(ni, nj);
         if (dz > maxDrop) {
             maxDrop = dz;
-            bestI = ni;
-            bestJ = nj;
+            best = flowCode(di, dj);
         }
     }
-    return {bestI,bestJ};  // (-1,-1) if no downslope neighbor
+    return best;
+}
+
+std::pair<int,int> GeoTiffHandler::downslope(int i, int j, FlowDirType type) const {
+    int di, dj;
+    const uint8_t code = tiles_ ? neighborFlowCode(i, j, type) : flowDirections(type)(i, j);
+    if (!flowOffset(code, di, dj)) {
+        return {-1, -1};  // no downslope neighbor
+    }
+    return {i + di, j + dj};
 }
 
 
 bool GeoTiffHandler::drainsTo(int i0, int j0, int itarget, int jtarget, FlowDirType type) const {
+    // Tiled rasters are routed cell by cell instead of through a whole-grid layer
+    const RasterBuffer<uint8_t>* dirs = tiles_ ? nullptr : &flowDirections(type);
     int ci = i0, cj = j0;
-    std::set<std::pair<int,int>> visited; // avoid infinite loops
 
-    while (true) {
+    // Every step is strictly downhill (or across a routed flat), so a path visits each cell at most once
+    const size_t cells = static_cast<size_t>(width_) * height_;
+    for (size_t steps = 0; steps <= cells; ++steps) {
         if (ci == itarget && cj == jtarget) return true;
-        if (visited.count({ci,cj})) return false; // loop detected
-        visited.insert({ci,cj});
 
-        auto [ni, nj] = downslope(ci, cj, type);
-        if (ni == -1) return false; // pit or flat → doesn’t reach target
-        ci = ni;
-        cj = nj;
+        int di, dj;
+        const uint8_t code = dirs ? (*dirs)(ci, cj) : neighborFlowCode(ci, cj, type);
+        if (!flowOffset(code, di, dj)) return false; // pit or flat → doesn’t reach target
+        ci += di;
+        cj += dj;
     }
+    return false;
 }
 
 
 GeoTiffHandler GeoTiffHandler::watershed(int itarget, int jtarget, FlowDirType type) const {
-    auto idx = [&](int i, int j){ return j * width_ + i; };
-
-    // Step 1. Build inflow adjacency
-    std::vector<std::vector<std::vector<std::pair<int,int>>>> inflow(
-        width_, std::vector<std::vector<std::pair<int,int>>>(height_));
+    int i0, j0, i1, j1;
+    const std::vector<uint32_t> cells = watershedCells(itarget, jtarget, type, i0, j0, i1, j1);
+    return maskedCrop(cells, i0, j0, i1, j1);
+}
 
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            auto [ni,nj] = downslope(i,j,type);
-            if (ni != -1 && nj != -1) {
-                inflow[ni][nj].push_back({i,j});
-            }
-        }
+std::vector<uint32_t> GeoTiffHandler::watershedCells(int itarget, int jtarget, FlowDirType type,
+                                                     int& i0, int& j0, int& i1, int& j1) const {
+    requireInMemory("watershed");
+    if (itarget < 0 || itarget >= width_ || jtarget < 0 || jtarget >= height_) {
+        throw std::out_of_range("Target indices out of range.");
     }
+    const uint32_t target = static_cast<uint32_t>(jtarget) * width_ + itarget;
+    return inflowIndex(type).upstream(target, i0, j0, i1, j1);
+}
 
-    // Step 2. BFS upstream from target
-    std::vector<bool> visited(width_ * height_, false);
-    std::queue<std::pair<int,int>> q;
-
-    q.push({itarget, jtarget});
-    visited[idx(itarget,jtarget)] = true;
-
-    while (!q.empty()) {
-        auto [ci, cj] = q.front(); q.pop();
-
-        for (auto& nb : inflow[ci][cj]) {
-            int ni = nb.first, nj = nb.second;
-            if (!visited[idx(ni,nj)]) {
-                // only accept if this cell drains to the target
-                if (drainsTo(ni, nj, itarget, jtarget, type)) {
-                    visited[idx(ni,nj)] = true;
-                    q.push({ni,nj});
-                }
-            }
-        }
+GeoTiffHandler GeoTiffHandler::maskedCrop(const std::vector<uint32_t>& cells, int i0, int j0, int i1, int j1) const {
+    GeoTiffHandler out = subset(i0, j0, i1 - i0 + 1, j1 - j0 + 1);
+    const RasterBuffer<float> dem = out.data_.toFloat();
+    RasterBuffer<float> masked(out.width_, out.height_, std::nanf(""));
+    for (uint32_t k : cells) {
+        const int i = static_cast<int>(k % width_) - i0;
+        const int j = static_cast<int>(k / width_) - j0;
+        masked(i, j) = dem(i, j);
     }
+    out.setPixels(std::move(masked));
+    return out;
+}
 
-    // Step 3. Build masked output (same size as input)
+GeoTiffHandler GeoTiffHandler::maskedCopy(const std::vector<bool>& cells) const {
+    // Masked output, same size as input
     GeoTiffHandler out(*this); // copy metadata
-    out.data_2d_.assign(width_, std::vector<double>(height_, std::nan("")));
-    out.data_.assign(width_ * height_, std::nanf(""));
+    const RasterBuffer<float> dem = data_.toFloat();
+    RasterBuffer<float> masked(width_, height_, std::nanf(""));
+    float* o = masked.data();
 
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            if (visited[idx(i,j)]) {
-                out.data_2d_[i][j] = data_2d_[i][j];
-                out.data_[j * width_ + i] = static_cast<float>(data_2d_[i][j]);
-            }
-        }
+    for (size_t k = 0; k < cells.size(); ++k) {
+        if (cells[k]) o[k] = dem.data()[k];
     }
+    out.setPixels(std::move(masked));
 
     return out;
 }
 
 
-GeoTiffHandler GeoTiffHandler::cropMasked(double nodataThreshold) const {
+RasterView GeoTiffHandler::view(int i0, int j0, int width, int height) const {
+    return RasterView(*this, i0, j0, width, height);
+}
+
+RasterView GeoTiffHandler::croppedView(double nodataThreshold) const {
+    requireInMemory("croppedView");
     int minI = width_, maxI = -1;
     int minJ = height_, maxJ = -1;
 
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            double v = data_2d_[i][j];
-            if (!std::isnan(v) && v != nodataThreshold) {
+    const ValidityMask& mask = validity();
+    if (std::isnan(nodataThreshold)) {
+        mask.bounds(minI, minJ, maxI, maxJ);
+    } else {
+        // Only valid cells can widen the box; empty 64-cell words are skipped
+        mask.forEachValid([&](int i, int j) {
+            if (data_.value(i, j) != nodataThreshold) {
                 minI = std::min(minI, i);
                 maxI = std::max(maxI, i);
                 minJ = std::min(minJ, j);
                 maxJ = std::max(maxJ, j);
             }
-        }
+        });
     }
 
     if (minI > maxI || minJ > maxJ) {
         throw std::runtime_error("No valid data to crop.");
     }
 
-    int newW = maxI - minI + 1;
-    int newH = maxJ - minJ + 1;
-
-    GeoTiffHandler out(newW, newH);
-    out.dx_ = dx_;
-    out.dy_ = dy_;
-
-    out.x_.resize(newW);
-    for (int ii = 0; ii < newW; ++ii) out.x_[ii] = x_[minI + ii];
-
-    out.y_.resize(newH);
-    for (int jj = 0; jj < newH; ++jj) out.y_[jj] = y_[minJ + jj];
+    return RasterView(*this, minI, minJ, maxI - minI + 1, maxJ - minJ + 1);
+}
 
-    out.data_2d_.assign(newW, std::vector<double>(newH, std::nan("")));
-    out.data_.resize(newW * newH);
+GeoTiffHandler GeoTiffHandler::subset(int i0, int j0, int width, int height) const {
+    if (i0 < 0 || j0 < 0 || width < 0 || height < 0 || i0 + width > width_ || j0 + height > height_) {
+        throw std::out_of_range("subset: window outside raster.");
+    }
 
-    for (int i = minI; i <= maxI; ++i) {
-        for (int j = minJ; j <= maxJ; ++j) {
-            int ni = i - minI;
-            int nj = j - minJ;
-            out.data_2d_[ni][nj] = data_2d_[i][j];
-            out.data_[nj * newW + ni] = static_cast<float>(out.data_2d_[ni][nj]);
+    GeoTiffHandler out(width, height);
+    GeoReference g;
+    g.dx = geo_->dx;
+    g.dy = geo_->dy;
+    g.projection = geo_->projection;
+    g.x.assign(geo_->x.begin() + i0, geo_->x.begin() + i0 + width);
+    g.y.assign(geo_->y.begin() + j0, geo_->y.begin() + j0 + height);
+    out.setGeo(std::move(g));
 
+    if (tiles_) {
+        RasterBuffer<float> window(width, height);
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) window(i, j) = static_cast<float>(cellValue(i0 + i, j0 + j));
         }
+        out.setPixels(std::move(window));
+    } else {
+        // Copy the window, keeping the pixel type
+        out.setPixels(data_.window(i0, j0, width, height));
     }
 
     return out;
 }
 
+GeoTiffHandler GeoTiffHandler::cropMasked(double nodataThreshold) const {
+    return croppedView(nodataThreshold).materialize();
+}
 
 
-std::tuple<int,int,double> GeoTiffHandler::maxCell() const {
-    int bestI = -1, bestJ = -1;
-    double maxVal = -std::numeric_limits<double>::infinity();
 
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            double v = data_2d_[i][j];
-            if (std::isnan(v)) continue; // skip NODATA
-            if (v > maxVal) {
-                maxVal = v;
-                bestI = i;
-                bestJ = j;
-            }
-        }
-    }
-    return {bestI, bestJ, maxVal};
+std::tuple<int,int,double> GeoTiffHandler::maxCell() const {
+    const RasterStatistics stats = statistics();
+    return {stats.maxI, stats.maxJ, stats.max};
 }
 
 std::tuple<int,int,double> GeoTiffHandler::minCell() const {
-    int bestI = -1, bestJ = -1;
-    double minVal = std::numeric_limits<double>::infinity();
-
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            double v = data_2d_[i][j];
-            if (std::isnan(v)) continue; // skip NODATA
-            if (v < minVal) {
-                minVal = v;
-                bestI = i;
-                bestJ = j;
-            }
-        }
-    }
-    return {bestI, bestJ, minVal};
+    const RasterStatistics stats = statistics();
+    return {stats.minI, stats.minJ, stats.min};
 }
 
 std::pair<int,int> GeoTiffHandler::maxCellIndex() const {
-    int bestI = -1, bestJ = -1;
-    double maxVal = -std::numeric_limits<double>::infinity();
-
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            double v = data_2d_[i][j];
-            if (std::isnan(v)) continue; // skip NODATA
-            if (v > maxVal) {
-                maxVal = v;
-                bestI = i;
-                bestJ = j;
-            }
-        }
-    }
-    return {bestI, bestJ};
+    auto [i, j, v] = maxCell();
+    (void)v;
+    return {i, j};
 }
 
 std::pair<int,int> GeoTiffHandler::minCellIndex() const {
-    int bestI = -1, bestJ = -1;
-    double minVal = std::numeric_limits<double>::infinity();
-
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            double v = data_2d_[i][j];
-            if (std::isnan(v)) continue; // skip NODATA
-            if (v < minVal) {
-                minVal = v;
-                bestI = i;
-                bestJ = j;
-            }
-        }
-    }
-    return {bestI, bestJ};
+    auto [i, j, v] = minCell();
+    (void)v;
+    return {i, j};
 }
 
 GeoTiffHandler GeoTiffHandler::watershedWithThreshold(int i, int j, int minSize, FlowDirType type) const {
@@ -672,45 +1057,47 @@ GeoTiffHandler GeoTiffHandler::watershedWithThreshold(int i, int j, int minSize,
         {0,0}, {1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,1}, {1,-1}, {-1,-1}
     };
 
-    GeoTiffHandler best(1,1); // dummy init
+    // Candidates are compared by cell count; only the chosen one is materialized
+    std::vector<uint32_t> best;
+    int bestBox[4] = {0, 0, 0, 0};
     int bestCount = -1;
+    const ValidityMask& mask = validity();
 
     for (auto [di, dj] : dirsD8) {
         int ni = i + di;
         int nj = j + dj;
         if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
 
-        GeoTiffHandler candidate = watershed(ni, nj, type);
+        int box[4];
+        std::vector<uint32_t> candidate = watershedCells(ni, nj, type, box[0], box[1], box[2], box[3]);
 
         // Count valid pixels
         int ccount = 0;
-        for (int ii = 0; ii < candidate.width(); ++ii) {
-            for (int jj = 0; jj < candidate.height(); ++jj) {
-                if (!std::isnan(candidate.data_2d_[ii][jj])) {
-                    ++ccount;
-                }
-            }
+        for (uint32_t k : candidate) {
+            if (mask.valid(k % width_, k / width_)) ++ccount;
         }
 
         // If the target watershed already meets threshold, return immediately
         if (di == 0 && dj == 0 && ccount >= minSize) {
-            return candidate;
+            return maskedCrop(candidate, box[0], box[1], box[2], box[3]);
         }
 
         if (ccount > bestCount) {
             best = std::move(candidate);
+            std::copy(box, box + 4, bestBox);
             bestCount = ccount;
         }
     }
 
-    return best; // largest among neighbors if threshold not met
+    if (best.empty()) return GeoTiffHandler(1,1); // target outside the raster
+    return maskedCrop(best, bestBox[0], bestBox[1], bestBox[2], bestBox[3]); // largest among neighbors if threshold not met
 }
 
 QString GeoTiffHandler::info(const QString& fileName) const {
-    double xmin = x_.empty() ? 0.0 : *std::min_element(x_.begin(), x_.end()) - 0.5 * dx_;
-    double xmax = x_.empty() ? 0.0 : *std::max_element(x_.begin(), x_.end()) + 0.5 * dx_;
-    double ymin = y_.empty() ? 0.0 : *std::min_element(y_.begin(), y_.end()) - 0.5 * std::abs(dy_);
-    double ymax = y_.empty() ? 0.0 : *std::max_element(y_.begin(), y_.end()) + 0.5 * std::abs(dy_);
+    double xmin = geo_->x.empty() ? 0.0 : *std::min_element(geo_->x.begin(), geo_->x.end()) - 0.5 * geo_->dx;
+    double xmax = geo_->x.empty() ? 0.0 : *std::max_element(geo_->x.begin(), geo_->x.end()) + 0.5 * geo_->dx;
+    double ymin = geo_->y.empty() ? 0.0 : *std::min_element(geo_->y.begin(), geo_->y.end()) - 0.5 * std::abs(geo_->dy);
+    double ymax = geo_->y.empty() ? 0.0 : *std::max_element(geo_->y.begin(), geo_->y.end()) + 0.5 * std::abs(geo_->dy);
 
     QString infoStr = QString(
                           "File: %1\n"
@@ -735,8 +1122,8 @@ QString GeoTiffHandler::info(const QString& fileName) const {
                           .arg(bands_)
                           .arg(minValue())
                           .arg(maxValue())
-                          .arg(dx_)
-                          .arg(dy_)
+                          .arg(geo_->dx)
+                          .arg(geo_->dy)
                           .arg(xmin)
                           .arg(xmax)
                           .arg(ymin)
@@ -766,18 +1153,19 @@ QString GeoTiffHandler::info(const QString& fileName) const {
 
 // --- MFD inflow construction ---
 std::vector<std::vector<std::vector<std::pair<int,int>>>> GeoTiffHandler::buildInflowMFD(
-    const std::vector<std::vector<double>>& dem,
-    int width, int height,
+    RasterSpan<const float> dem,
     FlowDirType type)
 {
     const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    const int width = dem.width();
+    const int height = dem.height();
 
     std::vector<std::vector<std::vector<std::pair<int,int>>>> inflow(
         width, std::vector<std::vector<std::pair<int,int>>>(height));
 
-    for (int i = 0; i < width; ++i) {
-        for (int j = 0; j < height; ++j) {
-            double z = dem[i][j];
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            double z = dem(i, j);
             std::vector<std::pair<int,int>> downs;
 
             // find all downslope neighbors
@@ -785,7 +1173,7 @@ std::vector<std::vector<std::vector<std::pair<int,int>>>> GeoTiffHandler::buildI
                 int ni = i + di, nj = j + dj;
                 if (ni < 0 || ni >= width || nj < 0 || nj >= height) continue;
 
-                double dz = z - dem[ni][nj];
+                double dz = z - dem(ni, nj);
                 if (dz > 0) downs.push_back({ni,nj});
             }
 
@@ -798,82 +1186,275 @@ std::vector<std::vector<std::vector<std::pair<int,int>>>> GeoTiffHandler::buildI
     return inflow;
 }
 
+BasinLabels GeoTiffHandler::labelBasins(const std::vector<std::pair<int,int>>& pourPoints,
+                                        FlowDirType type, int threads) const {
+    const size_t n = pourPoints.size();
+    PixelBuffer labelPixels(PixelType::Int32, width_, height_, -1.0);
+    labelPixels.setNoData(-1.0);
+    int32_t* labels = labelPixels.as<int32_t>().data();
+
+    // Claim the outlet cells first: every walk stops where another basin starts
+    std::vector<uint32_t> outlets(n);
+    std::vector<bool> owner(n, false);
+    for (size_t k = 0; k < n; ++k) {
+        auto [i, j] = pourPoints[k];
+        if (i < 0 || i >= width_ || j < 0 || j >= height_) {
+            throw std::out_of_range("Pour point indices out of range.");
+        }
+        outlets[k] = static_cast<uint32_t>(j) * width_ + i;
+        if (labels[outlets[k]] == -1) {
+            labels[outlets[k]] = static_cast<int32_t>(k);
+            owner[k] = true;
+        }
+    }
+
+    BasinLabels result;
+    result.cellCounts.assign(n, 0);
+    result.bounds.assign(n, {-1, -1, -1, -1});
+    // Each cell has one receiver, so each is written by exactly one walk: no locking needed
+    const InflowIndex* inflow = n > 0 ? &inflowIndex(type) : nullptr;
+    auto walk = [&](size_t k) {
+        if (!owner[k]) return;
+        std::vector<uint32_t> queue(1, outlets[k]);
+        int i0 = outlets[k] % width_, i1 = i0;
+        int j0 = outlets[k] / width_, j1 = j0;
+        for (size_t head = 0; head < queue.size(); ++head) {
+            for (const uint32_t* d = inflow->begin(queue[head]); d != inflow->end(queue[head]); ++d) {
+                if (labels[*d] != -1) continue;  // another pour point
+                labels[*d] = static_cast<int32_t>(k);
+                const int i = static_cast<int>(*d % width_), j = static_cast<int>(*d / width_);
+                i0 = std::min(i0, i); i1 = std::max(i1, i);
+                j0 = std::min(j0, j); j1 = std::max(j1, j);
+                queue.push_back(*d);
+            }
+        }
+        result.cellCounts[k] = static_cast<long long>(queue.size());
+        result.bounds[k] = {i0, j0, i1, j1};
+    };
+
+    const size_t workers = std::min<size_t>(n, threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next(0);  // basins vary wildly in size: hand them out one at a time
+    auto work = [&] {
+        for (size_t k = next++; k < n; k = next++) walk(k);
+    };
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < workers; ++w) pool.emplace_back(work);
+    work();
+    for (std::thread& t : pool) t.join();
+
+    result.labels = GeoTiffHandler(width_, height_);
+    result.labels.geo_ = geo_;
+    result.labels.setPixels(std::move(labelPixels));
+    return result;
+}
+
+DrainageHeight GeoTiffHandler::heightAboveNearestDrainage(double minContributingArea, FlowDirType type,
+                                                          int threads) const {
+    if (static_cast<int64_t>(width_) * height_ > std::numeric_limits<int32_t>::max()) {
+        throw std::runtime_error("GeoTiffHandler::heightAboveNearestDrainage: drainage-cell ids are Int32, "
+                                 "so the raster must have fewer than 2^31 cells.");
+    }
+    const InflowIndex& inflow = inflowIndex(type);
+    const GeoTiffHandler accumulation = flowAccumulation(type, nullptr, threads);
+    const float* area = accumulation.data1D();
+
+    const bool direct = !tiles_ && data_.type() == PixelType::Float32;
+    const float* pixels = direct ? data_.as<float>().data() : nullptr;
+    auto z = [&](uint32_t k) -> double {
+        return direct ? pixels[k] : cellValue(static_cast<int>(k % width_), static_cast<int>(k / width_));
+    };
+
+    RasterBuffer<float> hand(width_, height_, std::nanf(""));
+    PixelBuffer drainagePixels(PixelType::Int32, width_, height_, -1.0);
+    drainagePixels.setNoData(-1.0);
+    int32_t* drainage = drainagePixels.as<int32_t>().data();
+    float* h = hand.data();
+
+    // Each stream cell roots the tree of non-stream cells draining to it; trees are disjoint
+    auto isStream = [&](uint32_t k) { return area[k] >= minContributingArea; };  // false for NaN
+    const int bandRows = 64;
+    const size_t bands = (height_ + bandRows - 1) / bandRows;
+    const size_t workers = std::min<size_t>(bands, threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        std::vector<uint32_t> queue;
+        for (size_t b = next++; b < bands; b = next++) {
+            const uint32_t begin = static_cast<uint32_t>(b * bandRows) * width_;
+            const uint32_t end = static_cast<uint32_t>(std::min<size_t>((b + 1) * bandRows, height_)) * width_;
+            for (uint32_t root = begin; root < end; ++root) {
+                if (!isStream(root)) continue;
+                const double base = z(root);
+                h[root] = 0.0f;
+                drainage[root] = static_cast<int32_t>(root);
+                queue.assign(1, root);
+                for (size_t head = 0; head < queue.size(); ++head) {
+                    for (const uint32_t* d = inflow.begin(queue[head]); d != inflow.end(queue[head]); ++d) {
+                        if (isStream(*d)) continue;  // roots its own tree
+                        h[*d] = static_cast<float>(z(*d) - base);
+                        drainage[*d] = static_cast<int32_t>(root);
+                        queue.push_back(*d);
+                    }
+                }
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < workers; ++w) pool.emplace_back(work);
+    work();
+    for (std::thread& t : pool) t.join();
+
+    DrainageHeight result;
+    result.hand = GeoTiffHandler(width_, height_);
+    result.hand.geo_ = geo_;
+    result.hand.setPixels(std::move(hand));
+    result.drainage = GeoTiffHandler(width_, height_);
+    result.drainage.geo_ = geo_;
+    result.drainage.setPixels(std::move(drainagePixels));
+    return result;
+}
+
 GeoTiffHandler GeoTiffHandler::watershedMFD(int itarget, int jtarget, FlowDirType type) const {
-    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
-    auto idx = [&](int i, int j){ return j * width_ + i; };
+    const std::vector<uint8_t> cells = watershedMFDCells(itarget, jtarget, type);
 
-    std::vector<bool> visited(width_ * height_, false);
-    std::queue<std::pair<int,int>> q;
+    // Build masked output (same extent as DEM)
+    return maskedCopy(std::vector<bool>(cells.begin(), cells.end()));
+}
 
-    q.push({itarget,jtarget});
-    visited[idx(itarget,jtarget)] = true;
+std::vector<uint8_t> GeoTiffHandler::watershedMFDCells(int itarget, int jtarget, FlowDirType type) const {
+    requireInMemory("watershedMFD");
+    if (itarget < 0 || itarget >= width_ || jtarget < 0 || jtarget >= height_) {
+        throw std::out_of_range("Target indices out of range.");
+    }
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    const RasterBuffer<float> dem = data_.toFloat();
+    const float* z = dem.data();
+
+    // Upstream walk: a neighbor strictly higher than an accepted cell drains to
+    // the target through it. The queue holds flat indices; each cell enters once.
+    std::vector<uint8_t> inside(dem.size(), 0);
+    std::vector<uint32_t> queue(1, static_cast<uint32_t>(jtarget) * width_ + itarget);
+    inside[queue[0]] = 1;
 
-    while (!q.empty()) {
-        auto [ci, cj] = q.front(); q.pop();
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const int ci = static_cast<int>(queue[head] % width_);
+        const int cj = static_cast<int>(queue[head] / width_);
+        const float zc = z[queue[head]];
 
-        // Explore *all* neighbors — but only accept those that drain to target
         for (auto [di,dj] : dirs) {
             int ni = ci + di, nj = cj + dj;
             if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
 
-            if (!visited[idx(ni,nj)]) {
-                if (drainsToMFD(ni, nj, itarget, jtarget, type)) {
-                    visited[idx(ni,nj)] = true;
-                    q.push({ni,nj});
-                }
+            const uint32_t n = static_cast<uint32_t>(nj) * width_ + ni;
+            if (!inside[n] && z[n] > zc) {  // false for NaN
+                inside[n] = 1;
+                queue.push_back(n);
             }
         }
     }
+    return inside;
+}
 
-    // Build masked output (same extent as DEM)
-    GeoTiffHandler out(*this);
-    out.data_2d_.assign(width_, std::vector<double>(height_, std::nan("")));
-    out.data_.assign(width_ * height_, std::nanf(""));
+MFDContribution GeoTiffHandler::watershedMFDContribution(int itarget, int jtarget,
+                                                                         FlowDirType type, double exponent) const {
+    const std::vector<uint8_t> inside = watershedMFDCells(itarget, jtarget, type);
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    const RasterBuffer<float> dem = data_.toFloat();
+    const float* z = dem.data();
+    const uint32_t target = static_cast<uint32_t>(jtarget) * width_ + itarget;
+
+    // Weight of the flow from cell (i, j) to neighbor d (0 if not downslope)
+    auto weight = [&](int i, int j, int di, int dj) {
+        const int ni = i + di, nj = j + dj;
+        if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) return 0.0;
+        const double dz = static_cast<double>(z[dem.index(i, j)]) - z[dem.index(ni, nj)];
+        if (!(dz > 0)) return 0.0;
+        const double dist = (di == 0 || dj == 0) ? 1.0 : std::sqrt(2.0);
+        return std::pow(dz / dist, exponent);
+    };
 
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            if (visited[idx(i,j)]) {
-                out.data_2d_[i][j] = data_2d_[i][j];
-                out.data_[j * width_ + i] = static_cast<float>(data_2d_[i][j]);
+    // Kahn's algorithm from the target upward: a cell is final once all of its
+    // downslope neighbors inside the watershed are. pending counts those left.
+    std::vector<uint8_t> pending(inside.size(), 0);
+    for (size_t k = 0; k < inside.size(); ++k) {
+        if (!inside[k] || k == target) continue;
+        const int i = static_cast<int>(k % width_), j = static_cast<int>(k / width_);
+        for (auto [di,dj] : dirs) {
+            if (weight(i, j, di, dj) > 0 && inside[dem.index(i + di, j + dj)]) ++pending[k];
+        }
+    }
+
+    // Weighted inflow of fraction while pending, the cell's own fraction once final
+    std::vector<double> acc(inside.size(), 0.0);
+    std::vector<uint32_t> ready(1, target);
+    acc[target] = 1.0;
+
+    for (size_t head = 0; head < ready.size(); ++head) {
+        const uint32_t c = ready[head];
+        const int ci = static_cast<int>(c % width_), cj = static_cast<int>(c / width_);
+
+        // Hand this cell's fraction to every upslope neighbor inside the watershed
+        for (auto [di,dj] : dirs) {
+            const int ui = ci + di, uj = cj + dj;
+            if (ui < 0 || ui >= width_ || uj < 0 || uj >= height_) continue;
+            const uint32_t u = static_cast<uint32_t>(dem.index(ui, uj));
+            if (!inside[u] || u == target || !(z[u] > z[c])) continue;
+
+            acc[u] += weight(ui, uj, -di, -dj) * acc[c];
+            if (--pending[u] == 0) {
+                double sumw = 0.0;
+                for (auto [ddi,ddj] : dirs) sumw += weight(ui, uj, ddi, ddj);
+                acc[u] /= sumw;
+                ready.push_back(u);
             }
         }
     }
-    return out;
+
+    GeoTiffHandler mask(width_, height_);
+    mask.geo_ = geo_;
+    RasterBuffer<uint8_t> maskPixels(width_, height_);
+    std::copy(inside.begin(), inside.end(), maskPixels.data());
+    mask.setPixels(std::move(maskPixels));
+
+    RasterBuffer<float> fraction(width_, height_);
+    for (size_t k = 0; k < fraction.size(); ++k) {
+        fraction.data()[k] = std::isnan(z[k]) ? std::nanf("") : static_cast<float>(acc[k]);
+    }
+    GeoTiffHandler frac(width_, height_);
+    frac.geo_ = geo_;
+    frac.setPixels(std::move(fraction));
+
+    return {std::move(mask), std::move(frac)};
 }
 
 bool GeoTiffHandler::drainsToMFD(int i0, int j0, int itarget, int jtarget, FlowDirType type) const {
+    requireInMemory("drainsToMFD");
     const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
-    std::set<std::pair<int,int>> visited; // avoid infinite loops
+    const RasterBuffer<float> dem = data_.toFloat();
 
-    std::function<bool(int,int)> dfs = [&](int ci, int cj) -> bool {
-        // If we've reached the target, success
-        if (ci == itarget && cj == jtarget) return true;
-
-        // Prevent cycles
-        if (visited.count({ci,cj})) return false;
-        visited.insert({ci,cj});
+    // Iterative depth-first search along strictly descending steps
+    std::vector<uint8_t> visited(dem.size(), 0);
+    std::vector<std::pair<int,int>> stack(1, {i0, j0});
+    visited[dem.index(i0, j0)] = 1;
 
-        double z = data_2d_[ci][cj];
-        bool drains = false;
+    while (!stack.empty()) {
+        auto [ci, cj] = stack.back();
+        stack.pop_back();
+        if (ci == itarget && cj == jtarget) return true;
 
-        // Explore all downslope neighbors
+        const double z = dem(ci, cj);
         for (auto [di,dj] : dirs) {
             int ni = ci + di;
             int nj = cj + dj;
             if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
 
-            double dz = z - data_2d_[ni][nj];
-            if (dz > 0) { // only flow downhill
-                if (dfs(ni, nj)) {
-                    drains = true;
-                    break; // one valid path is enough
-                }
+            double dz = z - dem(ni, nj);
+            if (dz > 0 && !visited[dem.index(ni, nj)]) { // only flow downhill
+                visited[dem.index(ni, nj)] = 1;
+                stack.push_back({ni, nj});
             }
         }
-        return drains;
-    };
-
-    return dfs(i0, j0);
+    }
+    return false;
 }
 
 Path GeoTiffHandler::downstreamPath(int i0, int j0, FlowDirType type) const {
@@ -886,64 +1467,140 @@ Path GeoTiffHandler::downstreamPath(int i0, int j0, FlowDirType type) const {
     int cj = j0;
 
     // add starting point (cell center coords)
-    path.addPoint(x_[ci], y_[cj]);
+    path.addPoint(geo_->x[ci], geo_->y[cj]);
 
-    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    // follow the steepest-descent directions until a pit, flat or edge
+    const RasterBuffer<uint8_t>* flow = tiles_ ? nullptr : &flowDirections(type);
+    int di, dj;
+    while (flowOffset(flow ? (*flow)(ci, cj) : neighborFlowCode(ci, cj, type), di, dj)) {
+        ci += di;
+        cj += dj;
+        path.addPoint(geo_->x[ci], geo_->y[cj]);
+    }
 
-    while (true) {
-        double z = data_2d_[ci][cj];
-        int bestI = -1, bestJ = -1;
-        double maxDrop = 0.0;
+    return path;
+}
 
-        // search neighbors for steepest gradient
-        for (auto [di, dj] : dirs) {
-            int ni = ci + di;
-            int nj = cj + dj;
-            if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
+void GeoTiffHandler::flowLengthsTo(const std::vector<uint32_t>& roots, FlowDirType type,
+                                   const GeoTiffHandler* weights,
+                                   std::vector<double>& length, std::vector<uint32_t>& order) const {
+    if (weights && (weights->width_ != width_ || weights->height_ != height_)) {
+        throw std::invalid_argument("Flow length weights must match the raster size.");
+    }
+    const InflowIndex& inflow = inflowIndex(type);
+    const RasterBuffer<uint8_t>& codes = flowDirections(type);
+
+    const bool direct = weights && !weights->tiles_;
+    const RasterBuffer<float> w = direct ? weights->data_.toFloat() : RasterBuffer<float>();
+    auto weight = [&](uint32_t k) {
+        if (!weights) return 1.0;
+        const double v = direct ? w.data()[k] : weights->cellValue(static_cast<int>(k % width_), static_cast<int>(k / width_));
+        return std::isnan(v) ? 1.0 : v;
+    };
 
-            double dz = z - data_2d_[ni][nj];
-            if (dz > maxDrop) {
-                maxDrop = dz;
-                bestI = ni;
-                bestJ = nj;
-            }
+    // Map length of a step in each of the eight code directions
+    double step[8];
+    for (int d = 0; d < 8; ++d) {
+        step[d] = std::hypot(kFlowDX[d] * geo_->dx, kFlowDY[d] * geo_->dy);
+    }
+
+    length.assign(static_cast<size_t>(width_) * height_, std::nan(""));
+    order.assign(roots.begin(), roots.end());
+    for (uint32_t root : roots) length[root] = 0.0;
+    for (size_t head = 0; head < order.size(); ++head) {
+        const uint32_t r = order[head];
+        for (const uint32_t* d = inflow.begin(r); d != inflow.end(r); ++d) {
+            const int dir = countTrailingZeros(codes.data()[*d]);  // donors always carry a single-bit code
+            length[*d] = length[r] + step[dir] * 0.5 * (weight(*d) + weight(r));
+            order.push_back(*d);
         }
+    }
+}
 
-        if (bestI == -1 || maxDrop <= 0.0) {
-            // pit, flat, or edge
-            break;
+GeoTiffHandler GeoTiffHandler::flowLength(FlowLength direction, FlowDirType type,
+                                          const GeoTiffHandler* weights) const {
+    const RasterBuffer<uint8_t>& codes = flowDirections(type);
+
+    // Every flow path ends at a valid cell without a receiver
+    std::vector<uint32_t> ends;
+    for (uint32_t k = 0; k < codes.size(); ++k) {
+        if (codes.data()[k] == kFlowNone) ends.push_back(k);
+    }
+    std::vector<double> length;
+    std::vector<uint32_t> order;
+    flowLengthsTo(ends, type, weights, length, order);
+
+    if (direction == FlowLength::Upstream) {
+        // Longest path arriving at each cell: donors come after their receiver in order
+        std::vector<double> down(std::move(length));
+        length.assign(down.size(), std::nan(""));
+        for (uint32_t k : order) length[k] = 0.0;
+        for (size_t n = order.size(); n-- > 0; ) {
+            const uint32_t k = order[n];
+            int di, dj;
+            if (!flowOffset(codes.data()[k], di, dj)) continue;
+            const uint32_t r = static_cast<uint32_t>(static_cast<int64_t>(k) + static_cast<int64_t>(dj) * width_ + di);
+            length[r] = std::max(length[r], length[k] + (down[k] - down[r]));  // down[k] - down[r]: the step k -> r
         }
+    }
+
+    RasterBuffer<float> out(width_, height_);
+    for (size_t k = 0; k < length.size(); ++k) out.data()[k] = static_cast<float>(length[k]);
+    GeoTiffHandler result(width_, height_);
+    result.geo_ = geo_;
+    result.setPixels(std::move(out));
+    return result;
+}
+
+Polyline GeoTiffHandler::longestFlowPath(int i, int j, FlowDirType type, const GeoTiffHandler* weights) const {
+    if (i < 0 || i >= width_ || j < 0 || j >= height_) {
+        throw std::out_of_range("Pour point indices out of range.");
+    }
+    std::vector<double> length;
+    std::vector<uint32_t> order;
+    flowLengthsTo({static_cast<uint32_t>(j) * width_ + i}, type, weights, length, order);
 
-        ci = bestI;
-        cj = bestJ;
-        path.addPoint(x_[ci], y_[cj]);
+    uint32_t start = order.front();
+    for (uint32_t k : order) {
+        if (length[k] > length[start]) start = k;
     }
 
+    Polyline path;
+    const RasterBuffer<uint8_t>& codes = flowDirections(type);
+    int ci = static_cast<int>(start % width_), cj = static_cast<int>(start / width_);
+    int di, dj;
+    while (true) {
+        path.addPoint(geo_->x[ci], geo_->y[cj]);
+        path.setPointAttribute(path.size() - 1, "flow_length", length[static_cast<size_t>(cj) * width_ + ci]);
+        if (ci == i && cj == j) break;
+        flowOffset(codes(ci, cj), di, dj);  // every cell in order drains to the pour point
+        ci += di;
+        cj += dj;
+    }
     return path;
 }
 
 GeoTiffHandler GeoTiffHandler::detectSinks(FlowDirType type) const {
+    requireInMemory("detectSinks");
     // Prepare output raster with same dimensions
     GeoTiffHandler out(width_, height_);
-    out.dx_ = dx_;
-    out.dy_ = dy_;
-    out.x_ = x_;
-    out.y_ = y_;
-    out.data_2d_.assign(width_, std::vector<double>(height_, 0.0));
-    out.data_.assign(width_ * height_, 0.0f);
+    out.geo_ = geo_;
+    out.setPixels(PixelBuffer(PixelType::UInt8, width_, height_, 0.0));  // 0/1 mask
+    RasterBuffer<uint8_t>& mask = out.mutablePixels().as<uint8_t>();
+    const RasterBuffer<float> dem = data_.toFloat();
 
     const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
 
-    for (int i = 1; i < width_ - 1; ++i) {        // skip boundary cols
-        for (int j = 1; j < height_ - 1; ++j) {   // skip boundary rows
-            double z = data_2d_[i][j];
+    for (int j = 1; j < height_ - 1; ++j) {       // skip boundary rows
+        for (int i = 1; i < width_ - 1; ++i) {    // skip boundary cols
+            double z = dem(i, j);
             if (std::isnan(z)) continue; // skip nodata
 
             bool isSink = true;
             for (auto [di, dj] : dirs) {
                 int ni = i + di;
                 int nj = j + dj;
-                double zn = data_2d_[ni][nj];
+                double zn = dem(ni, nj);
                 if (std::isnan(zn)) continue;
 
                 if (z >= zn) { // not strictly lower
@@ -953,8 +1610,7 @@ GeoTiffHandler GeoTiffHandler::detectSinks(FlowDirType type) const {
             }
 
             if (isSink) {
-                out.data_2d_[i][j] = 1.0;
-                out.data_[j * width_ + i] = 1.0f;
+                mask(i, j) = 1;
             }
         }
     }
@@ -963,10 +1619,11 @@ GeoTiffHandler GeoTiffHandler::detectSinks(FlowDirType type) const {
 }
 
 GeoTiffHandler GeoTiffHandler::fillSinksIterative(FlowDirType type, int maxIter) const {
-    // Start with a copy of current DEM
+    requireInMemory("fillSinksIterative");
+    // Start with a copy of current DEM (as float: filled levels are fractional)
     GeoTiffHandler out(*this);
-    out.data_2d_ = data_2d_;
-    out.data_    = data_;
+    out.setPixels(data_.converted(PixelType::Float32));
+    RasterBuffer<float>& filled = out.mutablePixels().as<float>();
 
     const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
 
@@ -977,9 +1634,9 @@ GeoTiffHandler GeoTiffHandler::fillSinksIterative(FlowDirType type, int maxIter)
         changed = false;
         ++iter;
 
-        for (int i = 1; i < width_ - 1; ++i) {        // skip boundary
-            for (int j = 1; j < height_ - 1; ++j) {   // skip boundary
-                double z = out.data_2d_[i][j];
+        for (int j = 1; j < height_ - 1; ++j) {       // skip boundary
+            for (int i = 1; i < width_ - 1; ++i) {    // skip boundary
+                double z = filled(i, j);
                 if (std::isnan(z)) continue;
 
                 bool isSink = true;
@@ -989,7 +1646,7 @@ GeoTiffHandler GeoTiffHandler::fillSinksIterative(FlowDirType type, int maxIter)
                 for (auto [di, dj] : dirs) {
                     int ni = i + di;
                     int nj = j + dj;
-                    double zn = out.data_2d_[ni][nj];
+                    double zn = filled(ni, nj);
                     if (std::isnan(zn)) continue;
 
                     if (z >= zn) {
@@ -1003,8 +1660,7 @@ GeoTiffHandler GeoTiffHandler::fillSinksIterative(FlowDirType type, int maxIter)
                 if (isSink && count > 0) {
                     double newVal = sum / count;
                     if (newVal > z) {
-                        out.data_2d_[i][j] = newVal;
-                        out.data_[j * width_ + i] = static_cast<float>(newVal);
+                        filled(i, j) = static_cast<float>(newVal);
                         changed = true;
                     }
                 }
@@ -1015,126 +1671,409 @@ GeoTiffHandler GeoTiffHandler::fillSinksIterative(FlowDirType type, int maxIter)
     return out;
 }
 
-int GeoTiffHandler::countValidCells() const {
-    int count = 0;
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            if (!std::isnan(data_2d_[i][j])) {
-                ++count;
+GeoTiffHandler GeoTiffHandler::fillDepressions(FlowDirType type, FillMode mode, GeoTiffHandler* fillDepth) const {
+    requireInMemory("fillDepressions");
+    GeoTiffHandler out(*this);
+    out.setPixels(data_.converted(PixelType::Float32));  // epsilon steps are fractional
+    float* z = out.mutablePixels().as<float>().data();
+    auto idx = [&](int i, int j){ return static_cast<size_t>(j) * width_ + i; };
+
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+
+    // Open cells ordered by elevation, ties by insertion order (deterministic)
+    struct OpenCell {
+        float z;
+        uint64_t order;
+        int i, j;
+        bool operator>(const OpenCell& o) const { return z > o.z || (z == o.z && order > o.order); }
+    };
+    std::priority_queue<OpenCell, std::vector<OpenCell>, std::greater<OpenCell>> open;
+    std::queue<std::pair<int,int>> pit;  // cells raised to their spill level: no need to sort them
+    std::vector<uint8_t> closed(static_cast<size_t>(width_) * height_, 0);
+    uint64_t order = 0;
+
+    // Seeds: valid cells on the boundary or next to nodata
+    for (int j = 0; j < height_; ++j) {
+        for (int i = 0; i < width_; ++i) {
+            if (std::isnan(z[idx(i, j)])) continue;
+            bool edge = (i == 0 || j == 0 || i == width_ - 1 || j == height_ - 1);
+            for (size_t d = 0; d < dirs.size() && !edge; ++d) {
+                edge = std::isnan(z[idx(i + dirs[d].first, j + dirs[d].second)]);
+            }
+            if (edge) {
+                closed[idx(i, j)] = 1;
+                open.push({z[idx(i, j)], order++, i, j});
             }
         }
     }
-    return count;
-}
 
-GeoTiffHandler GeoTiffHandler::flowAccumulationMFD(FlowDirType type, double exponent) const {
-    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    while (!open.empty() || !pit.empty()) {
+        int ci, cj;
+        if (!pit.empty()) {
+            std::tie(ci, cj) = pit.front();
+            pit.pop();
+        } else {
+            ci = open.top().i;
+            cj = open.top().j;
+            open.pop();
+        }
+        const float spill = (mode == FillMode::Epsilon)
+            ? std::nextafter(z[idx(ci, cj)], std::numeric_limits<float>::infinity())
+            : z[idx(ci, cj)];
 
-    // -------------------------------------------------
-    // Step 0: Prepare output raster and initialize with 1
-    // -------------------------------------------------
-    GeoTiffHandler out(*this);
-    out.data_2d_.assign(width_, std::vector<double>(height_, fabs(dx_)*fabs(dy_)));
-    out.data_.assign(width_ * height_, fabs(dx_)*fabs(dy_));
-
-    // -------------------------------------------------
-    // Step 1: Sort cells by elevation (descending order)
-    // -------------------------------------------------
-    std::vector<std::tuple<double,int,int>> cells;
-    cells.reserve(width_ * height_);
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
-            if (!std::isnan(data_2d_[i][j])) {
-                cells.emplace_back(-data_2d_[i][j], i, j); // negative so sort gives descending
+        for (auto [di, dj] : dirs) {
+            const int ni = ci + di, nj = cj + dj;
+            if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
+            const size_t k = idx(ni, nj);
+            if (closed[k] || std::isnan(z[k])) continue;
+            closed[k] = 1;
+
+            if (z[k] <= spill) {
+                z[k] = spill;  // inside a depression: raise and flood on
+                pit.push({ni, nj});
+            } else {
+                open.push({z[k], order++, ni, nj});
             }
         }
     }
-    std::sort(cells.begin(), cells.end());
 
-    // -------------------------------------------------
-    // Step 2: Process cells from highest to lowest
-    // -------------------------------------------------
-    for (auto [negz, i, j] : cells) {
-        double z = data_2d_[i][j];
-        double contrib = out.data_2d_[i][j];
+    if (fillDepth) {
+        const RasterBuffer<float> original = data_.toFloat();
+        RasterBuffer<float> depth(width_, height_);
+        for (size_t k = 0; k < depth.size(); ++k) {
+            depth.data()[k] = z[k] - original.data()[k];  // NaN stays NaN
+        }
+        GeoTiffHandler d(width_, height_);
+        d.geo_ = geo_;
+        d.setPixels(std::move(depth));
+        *fillDepth = std::move(d);
+    }
 
-        // -------------------------------------------------
-        // Step 2a: Find all downslope neighbors and compute weights
-        // -------------------------------------------------
-        std::vector<std::pair<int,int>> downs;
-        std::vector<double> weights;
-        double sumw = 0.0;
+    return out;
+}
 
-        for (auto [di, dj] : dirs) {
-            int ni = i + di, nj = j + dj;
-            if (ni < 0 || ni >= width_ || nj < 0 || nj >= height_) continue;
+GeoTiffHandler GeoTiffHandler::breachDepressions(FlowDirType type, double maxDepth, int maxLength, bool fill,
+                                                 GeoTiffHandler* change) const {
+    requireInMemory("breachDepressions");
+    const RasterBuffer<float> original = data_.toFloat();
+    const float* z0 = original.data();  // maxDepth is measured from the terrain before any carving
+    GeoTiffHandler out(*this);
+    out.setPixels(original);
+    float* z = out.mutablePixels().as<float>().data();
+    const size_t n = static_cast<size_t>(width_) * height_;
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    const int nd = static_cast<int>(dirs.size());
+    double step[8];
+    for (int d = 0; d < nd; ++d) step[d] = std::hypot(dirs[d].first, dirs[d].second);
+    const float lowest = -std::numeric_limits<float>::infinity();
+    const uint32_t none = UINT32_MAX;
+
+    // Flow can leave the grid at the boundary and next to nodata
+    auto outlet = [&](int i, int j) {
+        if (i == 0 || j == 0 || i == width_ - 1 || j == height_ - 1) return true;
+        for (int d = 0; d < nd; ++d) {
+            if (std::isnan(z[static_cast<size_t>(j + dirs[d].second) * width_ + (i + dirs[d].first)])) return true;
+        }
+        return false;
+    };
+    auto drains = [&](int i, int j) {
+        const float zc = z[static_cast<size_t>(j) * width_ + i];
+        for (int d = 0; d < nd; ++d) {
+            if (z[static_cast<size_t>(j + dirs[d].second) * width_ + (i + dirs[d].first)] < zc) return true;
+        }
+        return false;
+    };
 
-            double dz = z - data_2d_[ni][nj];
-            if (dz > 0) { // downslope
-                double dist = (di == 0 || dj == 0) ? 1.0 : std::sqrt(2.0);
-                double w = std::pow(dz / dist, exponent);
-                downs.push_back({ni,nj});
-                weights.push_back(w);
-                sumw += w;
+    // Pits, lowest first (ties by position, so the result is deterministic)
+    std::vector<uint32_t> pits;
+    for (int j = 1; j < height_ - 1; ++j) {
+        for (int i = 1; i < width_ - 1; ++i) {
+            const uint32_t k = static_cast<uint32_t>(j) * width_ + i;
+            if (!std::isnan(z[k]) && !outlet(i, j) && !drains(i, j)) pits.push_back(k);
+        }
+    }
+    std::sort(pits.begin(), pits.end(), [z](uint32_t a, uint32_t b) { return z[a] < z[b] || (z[a] == z[b] && a < b); });
+
+    // Search state, valid where stamp == the current search
+    std::vector<uint32_t> stamp(n, 0);
+    std::vector<double> cost(n);
+    std::vector<uint8_t> from(n);  // direction index back toward the pit
+    struct Step {
+        double cost;
+        uint32_t length;
+        uint32_t k;
+        bool operator>(const Step& o) const { return cost > o.cost || (cost == o.cost && length > o.length); }
+    };
+    std::vector<Step> heap;
+    const std::greater<Step> later;
+    std::vector<uint32_t> path;
+
+    bool unresolved = false;
+    uint32_t search = 0;
+    std::vector<uint32_t> retry;  // outlets cut into pits by a channel, handled before the next pit
+    for (size_t q = 0; q < pits.size() || !retry.empty(); ) {
+        uint32_t pit;
+        if (!retry.empty()) {
+            pit = retry.back();
+            retry.pop_back();
+        } else {
+            pit = pits[q++];
+        }
+        const int pi = static_cast<int>(pit % width_), pj = static_cast<int>(pit / width_);
+        if (drains(pi, pj)) continue;  // opened by an earlier channel
+        const float zp = z[pit];
+
+        ++search;
+        stamp[pit] = search;
+        cost[pit] = 0.0;
+        heap.assign(1, Step{0.0, 0, pit});
+        uint32_t end = none;
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            const Step s = heap.back();
+            heap.pop_back();
+            if (s.cost > cost[s.k]) continue;  // superseded
+            const int ci = static_cast<int>(s.k % width_), cj = static_cast<int>(s.k / width_);
+            if (s.k != pit && (z[s.k] < zp || outlet(ci, cj))) {
+                end = s.k;
+                break;
+            }
+            if (maxLength > 0 && s.length >= static_cast<uint32_t>(maxLength)) continue;
+
+            for (int d = 0; d < nd; ++d) {
+                const int ni = ci + dirs[d].first, nj = cj + dirs[d].second;
+                const uint32_t k = static_cast<uint32_t>(nj) * width_ + ni;
+                if (std::isnan(z[k])) continue;
+                if (static_cast<double>(z0[k]) - zp > maxDepth) continue;
+                const double c = s.cost + step[d] * std::max(0.0, static_cast<double>(z[k]) - zp);
+                if (stamp[k] == search && c >= cost[k]) continue;
+                stamp[k] = search;
+                cost[k] = c;
+                from[k] = static_cast<uint8_t>(d);
+                heap.push_back(Step{c, s.length + 1, k});
+                std::push_heap(heap.begin(), heap.end(), later);
             }
         }
+        if (end == none) {
+            unresolved = true;
+            continue;
+        }
 
-        // -------------------------------------------------
-        // Step 2b: Distribute contribution proportionally
-        // -------------------------------------------------
-        if (sumw > 0.0) {
-            for (size_t k = 0; k < downs.size(); ++k) {
-                int ni = downs[k].first;
-                int nj = downs[k].second;
-                double frac = weights[k] / sumw;
-                out.data_2d_[ni][nj] += contrib * frac;
+        // Channel from the pit to its outlet, lowered to descend all the way
+        path.clear();
+        for (uint32_t k = end; k != pit; ) {
+            path.push_back(k);
+            const int d = from[k];
+            k = static_cast<uint32_t>(static_cast<int64_t>(k) - static_cast<int64_t>(dirs[d].second) * width_ - dirs[d].first);
+        }
+        std::reverse(path.begin(), path.end());
+        const double zEnd = z[end];
+        float previous = zp;
+        for (size_t p = 0; p < path.size(); ++p) {
+            const uint32_t k = path[p];
+            if (k == end && zEnd < previous) break;  // a lower outlet keeps its elevation
+            // Spread the descent evenly toward a lower outlet; otherwise step down by one ulp
+            float target = std::nextafter(previous, lowest);
+            if (zEnd < zp) {
+                const float even = static_cast<float>(zp + (zEnd - zp) * (p + 1) / path.size());
+                if (even < previous && even > zEnd) target = even;
             }
+            z[k] = std::min(z[k], target);
+            previous = z[k];
         }
+
+        // Too little room between pit and outlet for a float descent: the
+        // outlet was cut down too and may need a channel of its own
+        const int ei = static_cast<int>(end % width_), ej = static_cast<int>(end / width_);
+        if (z[end] < zEnd && !outlet(ei, ej) && !drains(ei, ej)) retry.push_back(end);
     }
 
-    // -------------------------------------------------
-    // Step 3: Flatten 2D accumulation grid back to 1D buffer
-    // -------------------------------------------------
-    for (int j = 0; j < height_; ++j) {
-        for (int i = 0; i < width_; ++i) {
-            out.data_[j * width_ + i] = static_cast<float>(out.data_2d_[i][j]);
+    if (fill && unresolved) {
+        out = out.fillDepressions(type, FillMode::Flat);
+    }
+
+    if (change) {
+        const float* result = out.data_.as<float>().data();
+        RasterBuffer<float> delta(width_, height_);
+        for (size_t k = 0; k < delta.size(); ++k) {
+            delta.data()[k] = result[k] - z0[k];  // NaN stays NaN
         }
+        GeoTiffHandler d(width_, height_);
+        d.geo_ = geo_;
+        d.setPixels(std::move(delta));
+        *change = std::move(d);
     }
 
     return out;
 }
 
-GeoTiffHandler GeoTiffHandler::filterByThreshold(double threshold, FilterMode mode) const {
-    GeoTiffHandler out(*this);
-    out.data_2d_.assign(width_, std::vector<double>(height_, std::nan("")));
-    out.data_.assign(width_ * height_, std::nanf(""));
+int GeoTiffHandler::countValidCells() const {
+    if (!tiles_) {
+        return static_cast<int>(validity().count());  // one popcount per 64 cells
+    }
+    return static_cast<int>(statistics().count);
+}
 
-    for (int i = 0; i < width_; ++i) {
+GeoTiffHandler GeoTiffHandler::flowAccumulation(FlowDirType type, const GeoTiffHandler* weights,
+                                                int threads) const {
+    if (weights && (weights->width_ != width_ || weights->height_ != height_)) {
+        throw std::invalid_argument("Flow accumulation weights must match the raster size.");
+    }
+    const RasterBuffer<uint8_t>& codes = flowDirections(type);
+
+    // Own contribution of every cell
+    const double area = fabs(geo_->dx) * fabs(geo_->dy);
+    RasterBuffer<double> acc(width_, height_, area);
+    if (weights) {
+        const bool direct = !weights->tiles_;
+        const RasterBuffer<float> w = direct ? weights->data_.toFloat() : RasterBuffer<float>();
         for (int j = 0; j < height_; ++j) {
-            double v = data_2d_[i][j];
-            if (std::isnan(v)) continue;
+            for (int i = 0; i < width_; ++i) {
+                const double v = direct ? w(i, j) : weights->cellValue(i, j);
+                acc(i, j) = std::isnan(v) ? 0.0 : area * v;
+            }
+        }
+    }
+
+    accumulateFlow(codes, acc, threads);
+
+    RasterBuffer<float> accumulation(width_, height_);
+    float* o = accumulation.data();
+    for (size_t k = 0; k < acc.size(); ++k) {
+        o[k] = codes.data()[k] == kFlowNoData ? std::nanf("") : static_cast<float>(acc.data()[k]);
+    }
+    GeoTiffHandler out(width_, height_);
+    out.geo_ = geo_;
+    out.setPixels(std::move(accumulation));
+    return out;
+}
+
+void GeoTiffHandler::flowAccumulationTiled(const std::string& demFile, const std::string& outputFile,
+                                           FlowDirType type, const GeoTiffWriteOptions& options,
+                                           int tileSize, int threads) {
+    if (tileSize < 16 || tileSize > 16384) {
+        throw std::invalid_argument("flowAccumulationTiled: tileSize must be in [16, 16384].");
+    }
+    if (options.cloudOptimized) {
+        throw std::invalid_argument("flowAccumulationTiled writes tile by tile and cannot produce a COG directly.");
+    }
+    if (options.tiled) {
+        tileSize = (tileSize + options.blockSize - 1) / options.blockSize * options.blockSize;
+    }
 
-            bool keep = false;
-            if (mode == FilterMode::Greater && v > threshold) keep = true;
-            if (mode == FilterMode::Smaller && v < threshold) keep = true;
+    GDALAllRegister();
+    GDALDataset* src = (GDALDataset*) GDALOpen(demFile.c_str(), GA_ReadOnly);
+    if (!src) {
+        throw std::runtime_error("Failed to open DEM: " + demFile);
+    }
+    const int width = src->GetRasterXSize();
+    const int height = src->GetRasterYSize();
+    GDALRasterBand* in = src->GetRasterBand(1);
+    int hasNodata = 0;
+    const float nodata = static_cast<float>(in->GetNoDataValue(&hasNodata));
+    double gt[6] = { 0.0, 1.0, 0.0, 0.0, 0.0, -1.0 };
+    const bool hasGt = (src->GetGeoTransform(gt) == CE_None);
+    const char* proj = src->GetProjectionRef();
 
-            if (keep) {
-                out.data_2d_[i][j] = v;
-                out.data_[j * width_ + i] = static_cast<float>(v);
+    GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    char** opts = driver ? creationOptions(options, PixelType::Float32, false) : nullptr;
+    GDALDataset* outDs = driver ? driver->Create(outputFile.c_str(), width, height, 1, GDT_Float32, opts) : nullptr;
+    CSLDestroy(opts);
+    if (!outDs) {
+        GDALClose(src);
+        throw std::runtime_error("Failed to create output GeoTIFF: " + outputFile);
+    }
+    if (hasGt) outDs->SetGeoTransform(gt);
+    if (proj && *proj) outDs->SetProjection(proj);
+    GDALRasterBand* out = outDs->GetRasterBand(1);
+    out->SetNoDataValue(std::nan(""));
+
+    // GDAL handles are not thread-safe: workers compute in parallel and take turns on I/O
+    std::mutex io;
+    std::atomic<bool> failed(false);
+    TileReader read = [&](int i0, int j0, int w, int h, float* z, size_t stride) {
+        std::lock_guard<std::mutex> lock(io);
+        if (in->RasterIO(GF_Read, i0, j0, w, h, z, w, h, GDT_Float32,
+                         sizeof(float), static_cast<GSpacing>(stride * sizeof(float))) != CE_None) {
+            failed = true;
+        }
+        if (!hasNodata) return;
+        for (int j = 0; j < h; ++j) {
+            float* row = z + static_cast<size_t>(j) * stride;
+            for (int i = 0; i < w; ++i) {
+                if (row[i] == nodata) row[i] = std::nanf("");
             }
         }
+    };
+    TileWriter write = [&](int i0, int j0, int w, int h, const float* acc) {
+        std::lock_guard<std::mutex> lock(io);
+        if (out->RasterIO(GF_Write, i0, j0, w, h, const_cast<float*>(acc), w, h, GDT_Float32, 0, 0) != CE_None) {
+            failed = true;
+        }
+    };
+
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+    accumulateFlowOutOfCore(width, height, tileSize, dirs, fabs(gt[1]) * fabs(gt[5]), read, write, threads);
+
+    GDALClose(src);
+    if (failed) {
+        GDALClose(outDs);
+        throw std::runtime_error("Error reading " + demFile + " or writing " + outputFile);
     }
 
+    if (options.overviews) {
+        std::vector<int> levels;
+        for (int f = 2; std::max(width, height) / (f / 2) > options.blockSize; f *= 2) {
+            levels.push_back(f);
+        }
+        if (!levels.empty() &&
+            outDs->BuildOverviews("AVERAGE", static_cast<int>(levels.size()), levels.data(),
+                                  0, nullptr, nullptr, nullptr) != CE_None) {
+            GDALClose(outDs);
+            throw std::runtime_error("Error building overviews for " + outputFile);
+        }
+    }
+    GDALClose(outDs);
+}
+
+GeoTiffHandler GeoTiffHandler::flowAccumulationMFD(FlowDirType type, double exponent, int threads) const {
+    requireInMemory("flowAccumulationMFD");
+    const auto& dirs = (type == FlowDirType::D4) ? dirsD4 : dirsD8;
+
+    // Each cell contributes its area (accumulated in double, stored as float)
+    RasterBuffer<double> acc(width_, height_, fabs(geo_->dx)*fabs(geo_->dy));
+    accumulateFlowMFD(data_.toFloat(), dirs, exponent, acc, threads);
+
+    GeoTiffHandler out(*this);
+    RasterBuffer<float> accumulation(width_, height_);  // fresh pixels, nothing to copy
+    float* o = accumulation.data();
+    for (size_t k = 0; k < acc.size(); ++k) {
+        o[k] = static_cast<float>(acc.data()[k]);
+    }
+    out.setPixels(std::move(accumulation));
+
+    return out;
+}
+
+GeoTiffHandler GeoTiffHandler::filterByThreshold(double threshold, FilterMode mode) const {
+    requireInMemory("filterByThreshold");
+    GeoTiffHandler out(*this);
+    const RasterBuffer<float> pixels = data_.toFloat();
+    RasterBuffer<float> kept(width_, height_, std::nanf(""));
+
+    thresholdKernel(pixels.data(), kept.data(), pixels.size(), threshold, mode == FilterMode::Greater);
+    out.setPixels(std::move(kept));
+
     return out;
 }
 
 double GeoTiffHandler::area() const {
-    // use absolute dy in case dy_ is negative (north-up convention)
-    return static_cast<double>(countValidCells()) * fabs(dx_) * fabs(dy_);
+    // use absolute dy in case geo_->dy is negative (north-up convention)
+    return static_cast<double>(countValidCells()) * fabs(geo_->dx) * fabs(geo_->dy);
 }
 
 GeoTiffHandler GeoTiffHandler::resampleAverage(int newNx, int newNy) const {
-    if (x_.empty() || y_.empty()) {
+    if (geo_->x.empty() || geo_->y.empty()) {
         throw std::runtime_error("Coordinate arrays not initialized.");
     }
     if (newNx <= 0 || newNy <= 0) {
@@ -1143,36 +2082,39 @@ GeoTiffHandler GeoTiffHandler::resampleAverage(int newNx, int newNy) const {
 
     // Create output with same metadata
     GeoTiffHandler out(*this);
+    out.tiles_.reset();  // result lives in memory even if the source is tiled
     out.width_  = newNx;
     out.height_ = newNy;
 
     // Recompute dx, dy
-    double xmin = x_.front() - 0.5 * dx_;
-    double xmax = x_.back()  + 0.5 * dx_;
-    double ymin = std::min(y_.front(), y_.back()) - 0.5 * std::abs(dy_);
-    double ymax = std::max(y_.front(), y_.back()) + 0.5 * std::abs(dy_);
+    double xmin = geo_->x.front() - 0.5 * geo_->dx;
+    double xmax = geo_->x.back()  + 0.5 * geo_->dx;
+    double ymin = std::min(geo_->y.front(), geo_->y.back()) - 0.5 * std::abs(geo_->dy);
+    double ymax = std::max(geo_->y.front(), geo_->y.back()) + 0.5 * std::abs(geo_->dy);
 
-    out.dx_ = (xmax - xmin) / newNx;
-    out.dy_ = (ymax - ymin) / newNy;
-    if (dy_ < 0) out.dy_ = -out.dy_;  // preserve orientation
+    GeoReference g;
+    g.projection = geo_->projection;
+    g.dx = (xmax - xmin) / newNx;
+    g.dy = (ymax - ymin) / newNy;
+    if (geo_->dy < 0) g.dy = -g.dy;  // preserve orientation
 
     // New coordinate vectors (cell centers)
-    out.x_.resize(newNx);
-    out.y_.resize(newNy);
+    g.x.resize(newNx);
+    g.y.resize(newNy);
     for (int i = 0; i < newNx; ++i) {
-        out.x_[i] = xmin + (i + 0.5) * out.dx_;
+        g.x[i] = xmin + (i + 0.5) * g.dx;
     }
     for (int j = 0; j < newNy; ++j) {
-        if (dy_ < 0) {
-            out.y_[j] = ymax + (j + 0.5) * out.dy_;
+        if (geo_->dy < 0) {
+            g.y[j] = ymax + (j + 0.5) * g.dy;
         } else {
-            out.y_[j] = ymin + (j + 0.5) * out.dy_;
+            g.y[j] = ymin + (j + 0.5) * g.dy;
         }
     }
+    out.setGeo(std::move(g));
 
     // Allocate output data
-    out.data_2d_.assign(newNx, std::vector<double>(newNy, std::nan("")));
-    out.data_.assign(newNx * newNy, std::nanf(""));
+    RasterBuffer<float> averaged(newNx, newNy, std::nanf(""));
 
     // Factor: how many source pixels per target pixel (roughly)
     double scaleX = static_cast<double>(width_) / newNx;
@@ -1193,9 +2135,9 @@ GeoTiffHandler GeoTiffHandler::resampleAverage(int newNx, int newNy) const {
             double sum = 0.0;
             int count = 0;
 
-            for (int ii = i0; ii <= i1; ++ii) {
-                for (int jj = j0; jj <= j1; ++jj) {
-                    double v = data_2d_[ii][jj];
+            for (int jj = j0; jj <= j1; ++jj) {
+                for (int ii = i0; ii <= i1; ++ii) {
+                    double v = cellValue(ii, jj);
                     if (!std::isnan(v)) {
                         sum += v;
                         count++;
@@ -1204,12 +2146,11 @@ GeoTiffHandler GeoTiffHandler::resampleAverage(int newNx, int newNy) const {
             }
 
             if (count > 0) {
-                double avg = sum / count;
-                out.data_2d_[i][j] = avg;
-                out.data_[j * newNx + i] = static_cast<float>(avg);
+                averaged(i, j) = static_cast<float>(sum / count);
             }
         }
     }
+    out.setPixels(std::move(averaged));
 
     return out;
 }
@@ -1220,13 +2161,14 @@ std::vector<std::pair<double,double>> GeoTiffHandler::cellCenters() const {
 
     for (int j = 0; j < height_; ++j) {
         for (int i = 0; i < width_; ++i) {
-            centers.emplace_back(x_[i], y_[j]);
+            centers.emplace_back(geo_->x[i], geo_->y[j]);
         }
     }
     return centers;
 }
 
 std::vector<Node> GeoTiffHandler::nodes(const GeoTiffHandler* valueRaster) const {
+    requireInMemory("nodes");
     // consistency check if valueRaster provided
     if (valueRaster) {
         if (valueRaster->width() != width_ || valueRaster->height() != height_) {
@@ -1237,20 +2179,17 @@ std::vector<Node> GeoTiffHandler::nodes(const GeoTiffHandler* valueRaster) const
     std::vector<Node> out;
     out.reserve(width_ * height_);
 
+    const RasterBuffer<float> pixels = data_.toFloat();
+    const RasterBuffer<float> values = valueRaster ? valueRaster->data_.toFloat() : pixels;
     for (int j = 0; j < height_; ++j) {
+        const float* row = pixels.row(j);
+        const float* valueRow = values.row(j);
         for (int i = 0; i < width_; ++i) {
-            double val;
-            if (valueRaster) {
-                val = valueRaster->data2D()[i][j];
-            } else {
-                val = data_2d_[i][j];
-            }
-
-            if (std::isnan(data_2d_[i][j])) {
+            if (std::isnan(row[i])) {
                 continue; // skip invalid cell
             }
 
-            out.emplace_back(x_[i], y_[j], val);
+            out.emplace_back(geo_->x[i], geo_->y[j], valueRow[i]);
         }
     }
 
@@ -1267,11 +2206,11 @@ void GeoTiffHandler::setVariable(const std::string& varName, int i, int j, const
     }
 
     // Initialize variable array if it doesn't exist
-    if (variables_.find(varName) == variables_.end()) {
+    if (variables_->find(varName) == variables_->end()) {
         initializeVariable(varName);
     }
 
-    variables_[varName][i][j] = value;
+    mutableVariables()[varName][i][j] = value;
 }
 
 QVariant GeoTiffHandler::getVariable(const std::string& varName, int i, int j) const {
@@ -1279,8 +2218,8 @@ QVariant GeoTiffHandler::getVariable(const std::string& varName, int i, int j) c
         throw std::out_of_range("Cell indices out of range");
     }
 
-    auto it = variables_.find(varName);
-    if (it == variables_.end()) {
+    auto it = variables_->find(varName);
+    if (it == variables_->end()) {
         return QVariant(); // Return invalid QVariant
     }
 
@@ -1288,29 +2227,29 @@ QVariant GeoTiffHandler::getVariable(const std::string& varName, int i, int j) c
 }
 
 bool GeoTiffHandler::hasVariable(const std::string& varName) const {
-    return variables_.find(varName) != variables_.end();
+    return variables_->find(varName) != variables_->end();
 }
 
 void GeoTiffHandler::removeVariable(const std::string& varName) {
-    variables_.erase(varName);
+    mutableVariables().erase(varName);
 }
 
 std::vector<std::string> GeoTiffHandler::getVariableNames() const {
     std::vector<std::string> names;
-    names.reserve(variables_.size());
-    for (const auto& pair : variables_) {
+    names.reserve(variables_->size());
+    for (const auto& pair : *variables_) {
         names.push_back(pair.first);
     }
     return names;
 }
 
 void GeoTiffHandler::initializeVariable(const std::string& varName, const QVariant& defaultValue) {
-    variables_[varName].assign(width_, std::vector<QVariant>(height_, defaultValue));
+    mutableVariables()[varName].assign(width_, std::vector<QVariant>(height_, defaultValue));
 }
 
 bool GeoTiffHandler::isVariableNumeric(const std::string& varName) const {
-    auto it = variables_.find(varName);
-    if (it == variables_.end()) {
+    auto it = variables_->find(varName);
+    if (it == variables_->end()) {
         return false;
     }
 
@@ -1328,8 +2267,8 @@ bool GeoTiffHandler::isVariableNumeric(const std::string& varName) const {
 
 void GeoTiffHandler::saveVariableAsGeoTiff(const std::string& varName, const std::string& filename, double nodataValue) const {
     // Check if variable exists
-    auto it = variables_.find(varName);
-    if (it == variables_.end()) {
+    auto it = variables_->find(varName);
+    if (it == variables_->end()) {
         throw std::runtime_error("Variable '" + varName + "' does not exist");
     }
 
@@ -1338,7 +2277,7 @@ void GeoTiffHandler::saveVariableAsGeoTiff(const std::string& varName, const std
         throw std::invalid_argument("Variable '" + varName + "' contains non-numeric data types");
     }
 
-    if (x_.empty() || y_.empty()) {
+    if (geo_->x.empty() || geo_->y.empty()) {
         throw std::runtime_error("Coordinate arrays not initialized");
     }
 
@@ -1362,20 +2301,17 @@ void GeoTiffHandler::saveVariableAsGeoTiff(const std::string& varName, const std
     try {
         // Construct geotransform
         double gt[6] = {0};
-        gt[0] = x_.front() - 0.5 * dx_;  // top-left corner x
-        gt[1] = dx_;
+        gt[0] = geo_->x.front() - 0.5 * geo_->dx;  // top-left corner x
+        gt[1] = geo_->dx;
         gt[2] = 0.0;
-        gt[3] = y_.front() - 0.5 * dy_;  // top-left corner y
+        gt[3] = geo_->y.front() - 0.5 * geo_->dy;  // top-left corner y
         gt[4] = 0.0;
-        gt[5] = dy_;
+        gt[5] = geo_->dy;
         outDs->SetGeoTransform(gt);
 
         // Copy projection if available
-        if (dataset_) {
-            const char* proj = dataset_->GetProjectionRef();
-            if (proj && strlen(proj) > 0) {
-                outDs->SetProjection(proj);
-            }
+        if (!geo_->projection.empty()) {
+            outDs->SetProjection(geo_->projection.c_str());
         }
 
         // Convert variable data to double array
@@ -1417,7 +2353,8 @@ void GeoTiffHandler::saveVariableAsGeoTiff(const std::string& varName, const std
 }
 
 GeoTiffHandler GeoTiffHandler::closestPolylineRaster(const PolylineSet& polylineSet, double nodataValue) const {
-    if (x_.empty() || y_.empty()) {
+    requireInMemory("closestPolylineRaster");
+    if (geo_->x.empty() || geo_->y.empty()) {
         throw std::runtime_error("Coordinate arrays not initialized");
     }
 
@@ -1425,23 +2362,26 @@ GeoTiffHandler GeoTiffHandler::closestPolylineRaster(const PolylineSet& polyline
         throw std::runtime_error("PolylineSet is empty");
     }
 
-    // Create output raster - copy all metadata from input
+    // Create output raster - shares metadata with the input, fresh Int32 label pixels
     GeoTiffHandler out(*this);
+    PixelBuffer labelPixels;
+    labelPixels.setNoData(nodataValue);
+    labelPixels.assign(PixelType::Int32, width_, height_, nodataValue);
+    out.setPixels(std::move(labelPixels));
+    RasterBuffer<int32_t>& labels = out.mutablePixels().as<int32_t>();
 
     // Process each pixel
-    for (int i = 0; i < width_; ++i) {
-        for (int j = 0; j < height_; ++j) {
+    for (int j = 0; j < height_; ++j) {
+        for (int i = 0; i < width_; ++i) {
 
             qDebug() << "Now doing: " << QString::number(i) + "," + QString::number(j);
-            // Skip if original pixel is invalid
-            if (std::isnan(data_2d_[i][j])) {
-                out.data_2d_[i][j] = nodataValue;
-                out.data_[j * width_ + i] = static_cast<float>(nodataValue);
+            // Skip if original pixel is invalid (already nodataValue)
+            if (std::isnan(data_.value(i, j))) {
                 continue;
             }
 
             // Get pixel center coordinates
-            Point pixelPoint(x_[i], y_[j]);
+            Point pixelPoint(geo_->x[i], geo_->y[j]);
 
             // Find closest polyline
             double minDistance = std::numeric_limits<double>::infinity();
@@ -1455,10 +2395,8 @@ GeoTiffHandler GeoTiffHandler::closestPolylineRaster(const PolylineSet& polyline
                 }
             }
 
-            // Store polyline index as double - ensure it's a valid number
-            double indexValue = static_cast<double>(closestIndex);
-            out.data_2d_[i][j] = indexValue;
-            out.data_[j * width_ + i] = static_cast<float>(indexValue);
+            // Store polyline index - ensure it's a valid number
+            labels(i, j) = static_cast<int32_t>(closestIndex);
         }
     }
 
@@ -1492,16 +2430,16 @@ void GeoTiffHandler::diagnoseGeoTiff(const std::string& filename) {
 
 
 std::pair<double, double> GeoTiffHandler::slopeAtBilinear(double xCoord, double yCoord) const {
-    if (x_.empty() || y_.empty()) {
+    if (geo_->x.empty() || geo_->y.empty()) {
         return {std::nan(""), std::nan("")};
     }
 
     // Convert world coords to fractional indices
-    double col = (xCoord - x_.front()) / dx_;
-    double row = (yCoord - y_.front()) / dy_;
+    double col = (xCoord - geo_->x.front()) / geo_->dx;
+    double row = (yCoord - geo_->y.front()) / geo_->dy;
 
-    if (dy_ < 0) {
-        row = (yCoord - y_.front()) / dy_;
+    if (geo_->dy < 0) {
+        row = (yCoord - geo_->y.front()) / geo_->dy;
     }
 
     // Check bounds - return NaN if outside valid area
@@ -1520,10 +2458,10 @@ std::pair<double, double> GeoTiffHandler::slopeAtBilinear(double xCoord, double
     double fy = row - j;
 
     // Get the four corner values
-    double z00 = data_2d_[i][j];
-    double z10 = data_2d_[i+1][j];
-    double z01 = data_2d_[i][j+1];
-    double z11 = data_2d_[i+1][j+1];
+    double z00 = cellValue(i, j);
+    double z10 = cellValue(i+1, j);
+    double z01 = cellValue(i, j+1);
+    double z11 = cellValue(i+1, j+1);
 
     // Return NaN if any corner value is NaN
     if (std::isnan(z00) || std::isnan(z10) || std::isnan(z01) || std::isnan(z11)) {
@@ -1531,15 +2469,15 @@ std::pair<double, double> GeoTiffHandler::slopeAtBilinear(double xCoord, double
     }
 
     // Calculate slopes using bilinear interpolation of partial derivatives
-    double dz_dx_bottom = (z10 - z00) / dx_;
-    double dz_dx_top = (z11 - z01) / dx_;
+    double dz_dx_bottom = (z10 - z00) / geo_->dx;
+    double dz_dx_top = (z11 - z01) / geo_->dx;
     double dz_dx = dz_dx_bottom * (1 - fy) + dz_dx_top * fy;
 
-    double dz_dy_left = (z01 - z00) / dy_;
-    double dz_dy_right = (z11 - z10) / dy_;
+    double dz_dy_left = (z01 - z00) / geo_->dy;
+    double dz_dy_right = (z11 - z10) / geo_->dy;
     double dz_dy = dz_dy_left * (1 - fx) + dz_dy_right * fx;
 
-    if (dy_ < 0) {
+    if (geo_->dy < 0) {
         dz_dy = -dz_dy;
     }
 
@@ -10,29 +10,130 @@
 #include "node.h"
 #include <QVariant>
 #include <map>
+#include <memory>
+#include <array>
+#include <limits>
 #include "polylineset.h"
+#include "rasterbuffer.h"
+#include "pixelbuffer.h"
+#include "validitymask.h"
+#include "rastertilecache.h"
+#include "rasterkernels.h"
+#include "flowdirection.h"
 
 /**
  * @class GeoTiffHandler
  * @brief A utility class for reading and processing GeoTIFF raster files using GDAL.
  *
  * This class loads raster data from a GeoTIFF file and provides access to
- * pixel values, spatial coordinates, and metadata. Data are stored in both
- * a flat 1D vector and a 2D grid for convenience.
+ * pixel values, spatial coordinates, and metadata. Pixels are held once, in
+ * a contiguous row-major PixelBuffer of the file's own type (or the
+ * narrowest type that fits, e.g. UInt8 masks and Int32 labels); 2D access
+ * goes through strided views.
+ *
+ * Copies are cheap: pixels and variables are copy-on-write and the
+ * geo-referencing is shared, so a copy only duplicates what it writes.
+ *
+ * Rasters larger than RAM can be opened in RasterAccessMode::Tiled. Point
+ * queries (valueAt, indicesAt, slopeAtBilinear, downslope and the routing
+ * built on it), statistics, resampling and neighborhood access then read
+ * blocks on demand; whole-grid operations require the in-memory mode.
  */
 
 class Path;
+class RasterView;
+struct MFDContribution;
+struct BasinLabels;
+struct DrainageHeight;
 
 enum class FlowDirType { D4, D8 };
 
+/// How pixels of a file-backed raster are held.
+enum class RasterAccessMode {
+    InMemory,  ///< Whole band read into memory on construction.
+    Tiled      ///< Blocks read on demand through an LRU tile cache.
+};
+
+/// File formats accepted by GeoTiffHandler::saveAs.
+enum class RasterFormat {
+    GeoTiff,  ///< GDAL GTiff in the raster's pixel type.
+    Native    ///< Memory-mappable NativeRaster cache file.
+};
+
+/**
+ * @struct GeoTiffWriteOptions
+ * @brief Layout and compression of GeoTIFFs written by GeoTiffHandler::saveAs.
+ *
+ * The defaults reproduce a plain uncompressed, strip-organized GTiff.
+ * Rasters that are mostly NaN (masks, cropped watersheds, label rasters)
+ * shrink by an order of magnitude with compressed().
+ */
+struct GeoTiffWriteOptions {
+    enum class Compression { None, Deflate, Zstd, Lzw };
+
+    Compression compression = Compression::None;
+    int level = 0;             ///< DEFLATE/ZSTD level (0 = driver default; ignored for LZW).
+    bool predictor = true;     ///< Horizontal (integer) or floating-point predictor when compressing.
+    bool tiled = false;        ///< Square internal tiles instead of strips.
+    int blockSize = 256;       ///< Tile edge in pixels (multiple of 16).
+    bool overviews = false;    ///< Build internal overviews (averaged, halving down to one tile).
+    bool cloudOptimized = false;  ///< Write a Cloud-Optimized GeoTIFF (COG driver; implies tiles and overviews).
+    int threads = 0;           ///< Compression threads (0 = all CPUs).
+
+    /// Tiled, DEFLATE-compressed with predictor, multi-threaded.
+    static GeoTiffWriteOptions compressed() {
+        GeoTiffWriteOptions o;
+        o.compression = Compression::Deflate;
+        o.tiled = true;
+        return o;
+    }
+
+    /// Cloud-Optimized GeoTIFF, DEFLATE-compressed with predictor and overviews.
+    static GeoTiffWriteOptions cog() {
+        GeoTiffWriteOptions o = compressed();
+        o.overviews = true;
+        o.cloudOptimized = true;
+        return o;
+    }
+};
+
+/**
+ * @struct GeoReference
+ * @brief Geo-referencing shared (immutably) between rasters derived from one another.
+ *
+ * Derived rasters that keep the source grid point at the same instance;
+ * anything that changes the grid builds a new one.
+ */
+struct GeoReference {
+    std::vector<double> x;   ///< X coordinates of cell centers.
+    std::vector<double> y;   ///< Y coordinates of cell centers.
+    double dx = 0.0;         ///< Cell size in x-direction.
+    double dy = 0.0;         ///< Cell size in y-direction.
+    std::string projection;  ///< Projection WKT (empty if unknown).
+};
+
 class GeoTiffHandler {
 public:
     /**
-     * @brief Constructor that loads a GeoTIFF file into memory.
+     * @brief Constructor that loads a GeoTIFF (or native raster) file into memory.
      * @param filename Path to the GeoTIFF file.
      * @throw std::runtime_error if the file cannot be opened or read.
      */
     explicit GeoTiffHandler(const std::string& filename);
+
+    /**
+     * @brief Constructor that opens a GeoTIFF with the requested access mode.
+     * @param filename Path to the GeoTIFF file.
+     * @param mode InMemory reads the whole band; Tiled reads blocks on demand.
+     * @param tileCacheBytes Memory budget of the tile cache (Tiled mode only).
+     *
+     * Native raster files (see saveAs) are recognized by their signature and
+     * memory-mapped regardless of mode.
+     *
+     * @throw std::runtime_error if the file cannot be opened or read.
+     */
+    GeoTiffHandler(const std::string& filename, RasterAccessMode mode,
+                   size_t tileCacheBytes = size_t(512) << 20);
     GeoTiffHandler(int width, int height);
     GeoTiffHandler();
     // Custom copy constructor and assignment
@@ -67,37 +168,119 @@ public:
      * @return Number of bands.
      */
     int bands() const;
+
+    /**
+     * @brief Check whether pixels are read on demand from disk.
+     * @return True in RasterAccessMode::Tiled.
+     */
+    bool isTiled() const;
+
+    /**
+     * @brief Get the type pixels are stored with.
+     * @return The file's type (narrowed, see pixelTypeFromGDAL) for loaded
+     *         rasters; UInt8 for masks, Int32 for labels, Float32 otherwise.
+     */
+    PixelType pixelType() const;
     ///@}
 
     /** @name Data Access */
     ///@{
     /**
      * @brief Get the 1D raster data buffer.
-     * @return Constant reference to the flat raster values (row-major order).
+     * @return Pointer to width() * height() flat raster values (row-major order).
+     * @throw std::runtime_error if pixels are not Float32 (see convertedTo()).
      */
-    const std::vector<float>& data1D() const;
+    const float* data1D() const;
 
     /**
-     * @brief Get the 2D raster data buffer.
-     * @return Constant reference to 2D raster values [i][j],
+     * @brief Get a 2D view of the raster data.
+     * @return Strided view addressed as (i, j),
      *         where i = column index (x), j = row index (y).
+     * @throw std::runtime_error if pixels are not Float32 (see convertedTo()).
+     */
+    RasterSpan<const float> data2D() const;
+
+    /**
+     * @brief Get the typed pixel store, whatever its pixel type.
+     * @return Constant reference to the pixels.
      */
-    const std::vector<std::vector<double>>& data2D() const;
+    const PixelBuffer& pixels() const;
+
+    /**
+     * @brief Copy of the raster with pixels converted to another type.
+     *
+     * Integer nodata becomes NaN when converting to float; NaN becomes the
+     * nodata value (or 0) when converting to an integer type.
+     *
+     * @param type Target pixel type.
+     * @return New raster sharing geo-referencing and variables.
+     */
+    GeoTiffHandler convertedTo(PixelType type) const;
+
+    /**
+     * @brief Get the packed mask of cells holding data.
+     *
+     * Built on first use from NaN (float) or the nodata value (integer) and
+     * cached until pixels change. The file's nodata value is applied on
+     * load (float nodata becomes NaN) and declared again on save.
+     *
+     * @return Constant reference to the mask, valid until pixels change.
+     */
+    const ValidityMask& validity() const;
+
+    /**
+     * @brief Get the value of one cell, in either access mode.
+     * @param i Column index.
+     * @param j Row index.
+     * @return Cell value (NaN for nodata).
+     */
+    double cellValue(int i, int j) const;
+
+    /**
+     * @brief Get a square neighborhood around a cell, in either access mode.
+     * @param i Column index of the center cell.
+     * @param j Row index of the center cell.
+     * @param radius Half-width of the window (1 gives a 3x3 block).
+     * @return (2r+1)x(2r+1) buffer; cells outside the raster are NaN.
+     */
+    RasterBuffer<float> neighborhood(int i, int j, int radius) const;
+    ///@}
+
+    /** @name Tiled Access */
+    ///@{
+    /**
+     * @brief Get the tile cache backing a tiled raster.
+     * @return Tile cache (iterable over tiles), or nullptr for in-memory rasters.
+     */
+    const RasterTileCache* tileCache() const;
+
+    /**
+     * @brief Change the memory budget of the tile cache (no-op for in-memory rasters).
+     * @param bytes Maximum bytes of pixels kept resident.
+     */
+    void setTileCacheBudget(size_t bytes);
     ///@}
 
     /** @name Statistics */
     ///@{
     /**
      * @brief Compute the minimum raster value.
-     * @return Minimum value in the raster.
+     * @return Minimum valid (non-NaN) value in the raster.
      */
     float minValue() const;
 
     /**
      * @brief Compute the maximum raster value.
-     * @return Maximum value in the raster.
+     * @return Maximum valid (non-NaN) value in the raster.
      */
     float maxValue() const;
+
+    /**
+     * @brief Min, max, their cells, sum, count and mean of the valid cells in one pass.
+     *
+     * Uses the vectorized kernels of rasterkernels.h; works in either access mode.
+     */
+    RasterStatistics statistics() const;
     ///@}
 
     /** @name GeoTransform */
@@ -105,7 +288,7 @@ public:
     /**
      * @brief Get one element of the GDAL GeoTransform array.
      * @param idx Index of the transform element (0–5).
-     * @return The requested transform value.
+     * @return The requested transform value (derived from x, y, dx and dy).
      * @throw std::runtime_error if GeoTransform is unavailable.
      *
      * GDAL GeoTransform array (gt):
@@ -117,6 +300,12 @@ public:
      * - gt[5] = n-s pixel resolution (negative for north-up)
      */
     double getGeoTransform(int idx) const;
+
+    /**
+     * @brief Get the projection (WKT) carried over from the source file.
+     * @return Projection string, empty if unknown.
+     */
+    const std::string& projection() const;
     ///@}
 
     /** @name Data Processing */
@@ -124,7 +313,6 @@ public:
     /**
      * @brief Normalize raster values to the [0, 1] range.
      *
-     * Both the 1D and 2D buffers are updated.
      */
     void normalize();
     ///@}
@@ -193,6 +381,20 @@ public:
      * @throw std::out_of_range if the coordinate is outside the raster bounds.
      */
     double valueAt(double xCoord, double yCoord) const;
+
+    /**
+     * @brief valueAt for many points at once (see RasterSampler).
+     * @param xs X coordinates.
+     * @param ys Y coordinates (same size as xs).
+     * @param threads Worker threads (0 = all CPUs).
+     * @return One value per point, NaN where valueAt would give NaN.
+     */
+    std::vector<double> valuesAt(const std::vector<double>& xs, const std::vector<double>& ys, int threads = 0) const;
+
+    /// slopeAtBilinear for many points at once (see RasterSampler).
+    std::vector<std::pair<double,double>> slopesAtBilinear(const std::vector<double>& xs,
+                                                           const std::vector<double>& ys,
+                                                           int threads = 0) const;
     ///@}
 
 
@@ -214,12 +416,28 @@ public:
     /** @name Output */
     ///@{
     /**
-     * @brief Save the current raster (data_2d) to a GeoTIFF file.
+     * @brief Save the current raster to a GeoTIFF or native raster file.
      *
-     * @param filename Path to the output GeoTIFF file.
+     * Native files (see NativeRaster) reload by memory-mapping, without
+     * decoding; use them for rasters that are reopened many times.
+     *
+     * @param filename Path to the output file.
+     * @param format Output format.
      * @throw std::runtime_error if saving fails.
      */
-    void saveAs(const std::string& filename) const;
+    void saveAs(const std::string& filename, RasterFormat format = RasterFormat::GeoTiff) const;
+
+    /**
+     * @brief Save the current raster to a GeoTIFF with explicit layout and compression.
+     *
+     * Pixels are handed to GDAL straight from the contiguous store (for COG
+     * output through a MEM dataset wrapping it), so no staging copy is made.
+     *
+     * @param filename Path to the output GeoTIFF file.
+     * @param options Tiling, compression, overviews and COG layout.
+     * @throw std::runtime_error if saving fails or a required driver is missing.
+     */
+    void saveAs(const std::string& filename, const GeoTiffWriteOptions& options) const;
     ///@}
 
 
@@ -247,7 +465,7 @@ public:
 
     /**
      * @brief Load raster from ESRI ASCII format.
-     * Overwrites current data_2d_, x_, y_, dx_, dy_, width_, height_.
+     * Overwrites the current pixels, geo-referencing, width_ and height_.
      * @param filename Input ASCII filename.
      * @throw std::runtime_error if parsing fails.
      */
@@ -257,31 +475,111 @@ public:
     /** @name Flow Accumulation */
     ///@{
     /**
-     * @brief Initialize flow accumulation grid (each cell = 1.0).
+     * @brief Single-flow-direction (D8 or D4) flow accumulation.
+     *
+     * Each valid cell contributes its area times its weight, so the result is
+     * in the units of flowAccumulationMFD (upslope area) unless weighted by,
+     * e.g., a rainfall or runoff-coefficient raster. Routed along
+     * flowDirections(type) in one topological pass, O(cells); with several
+     * threads the grid is accumulated tile by tile and stitched at the tile
+     * borders. Works in either access mode.
+     *
+     * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
+     * @param weights Optional per-cell weights on the same grid (NaN counts as 0).
+     * @param threads Worker threads (0 = all CPUs).
+     * @return Float32 accumulation raster (NaN at nodata cells).
+     * @throw std::invalid_argument if weights has a different size.
      */
-    void initFlowAccum();
+    GeoTiffHandler flowAccumulation(FlowDirType type = FlowDirType::D8,
+                                    const GeoTiffHandler* weights = nullptr,
+                                    int threads = 0) const;
 
     /**
-     * @brief Perform one iteration of flow accumulation update.
-     * Each cell receives contributions from higher-elevation neighbors.
-     * @return true if any updates occurred, false if stable.
+     * @brief Flow accumulation of a DEM file too large for memory, written straight to a GeoTIFF.
+     *
+     * The single-flow-direction accumulation of flowAccumulation (cell areas,
+     * unweighted), computed tile by tile through GDAL windows: tiles are
+     * accumulated independently, the flow between them is solved over a
+     * small graph of tile-border cells, and each tile is then finished and
+     * written (see accumulateFlowOutOfCore). Peak memory is about 30 bytes
+     * per cell of one tile per thread, plus roughly 100 bytes per tile-border
+     * cell: with 4096 x 4096 tiles, 10^10 cells need about 1 GB of border
+     * graph.
+     * Flats cut by tile borders drain across them like the flats of
+     * flowDirections; only their directions near the seams may differ.
+     *
+     * @param demFile Elevations (first band; declared nodata is honored).
+     * @param outputFile Float32 GeoTIFF on the DEM's grid (NaN at nodata).
+     * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
+     * @param options Output layout; tiles are widened to whole output blocks.
+     * @param tileSize Processing tile edge in cells.
+     * @param threads Worker threads (0 = all CPUs), each holding one tile.
+     * @throw std::invalid_argument for a tileSize outside [16, 16384] or COG output.
+     * @throw std::runtime_error if a file cannot be opened, read or written.
      */
-    bool updateFlowAccum();
+    static void flowAccumulationTiled(const std::string& demFile, const std::string& outputFile,
+                                      FlowDirType type = FlowDirType::D8,
+                                      const GeoTiffWriteOptions& options = GeoTiffWriteOptions::compressed(),
+                                      int tileSize = 4096, int threads = 0);
 
+    /** @name Flow Routing */
+    ///@{
     /**
-     * @brief Run flow accumulation until convergence.
-     * @param maxIter Maximum iterations (default 1000).
+     * @brief Steepest-descent flow directions, one ESRI D8 code per cell (see flowdirection.h).
+     *
+     * The neighbor with the largest strictly positive elevation drop wins (the
+     * first in neighbor order on ties). Cells on flats are then routed across
+     * the flat toward its outlet (see resolveFlats), so filled depressions
+     * drain completely without changing elevations; pits, undrainable flats
+     * and flat outlets on the grid edge or next to nodata get kFlowNone and
+     * nodata cells kFlowNoData. Computed once per FlowDirType on first use and
+     * shared by downslope, drainsTo, watershed, watershedWithThreshold and
+     * downstreamPath; dropped whenever the pixels change.
+     *
+     * In Tiled mode the layer still covers the whole grid (two bytes per cell
+     * while it is built); downslope, drainsTo and downstreamPath do not use it
+     * there and read the neighbors of each visited cell instead.
      */
-    void computeFlowAccum(int maxIter = 1000);
+    const RasterBuffer<uint8_t>& flowDirections(FlowDirType type = FlowDirType::D8) const;
+
+    /// flowDirections(type) as a UInt8 raster with nodata kFlowNoData, ready for saveAs.
+    GeoTiffHandler flowDirectionRaster(FlowDirType type = FlowDirType::D8) const;
+
+    /**
+     * @brief D-infinity (Tarboton) flow angles, one float per cell (see flowdirection.h).
+     *
+     * Radians counterclockwise from east, kFlowAngleNone where no facet slopes
+     * down and NaN at nodata. Cached like flowDirections.
+     */
+    const RasterBuffer<float>& flowAnglesDInf() const;
+
+    /// flowAnglesDInf() as a Float32 raster, ready for saveAs.
+    GeoTiffHandler flowAngleRasterDInf() const;
+
+    /**
+     * @brief D-infinity flow accumulation.
+     *
+     * Like flowAccumulationMFD, each cell contributes its area, but flow is
+     * split between at most the two neighbors bracketing the D-infinity
+     * angle, so dispersion is limited and the cost per cell stays small.
+     * Same dependency-driven, tiled engine as flowAccumulationMFD.
+     *
+     * @param threads Worker threads (0 = all CPUs).
+     * @return Float32 accumulation raster (NaN at nodata cells).
+     */
+    GeoTiffHandler flowAccumulationDInf(int threads = 0) const;
 
-    /** @name Flow Routing */
-    ///@{
     /**
-     * @brief Find the steepest downslope neighbor.
+     * @brief Find the steepest downslope neighbor (read from flowDirections(type)).
+     *
+     * In Tiled mode the neighbors are read on the fly and flats are not
+     * routed: a cell without a strictly lower neighbor gives (-1,-1).
+     *
      * @param i Column index of the cell.
      * @param j Row index of the cell.
      * @param type Neighborhood type: FlowDirType::D4 (N, S, E, W) or FlowDirType::D8 (diagonals included).
-     * @return Pair (ni, nj) of downslope neighbor, or (-1,-1) if no downslope neighbor exists (pit/flat).
+     * @return Pair (ni, nj) of downslope neighbor (on a flat, the next cell toward
+     *         its outlet), or (-1,-1) at pits, undrainable flats and flat outlets.
      */
     std::pair<int,int> downslope(int i, int j, FlowDirType type = FlowDirType::D4) const;
 
@@ -305,21 +603,158 @@ public:
      * @param type Neighborhood type (D4 or D8).
      * @return New GeoTiffHandler cropped to bounding box of watershed.
      *         Inside watershed = DEM values, outside = NaN.
+     * @throw std::out_of_range if the target is outside the raster.
+     *
+     * One breadth-first walk up the cached inflow index: O(basin size).
      */
     GeoTiffHandler watershed(int itarget, int jtarget, FlowDirType type = FlowDirType::D4) const;
 
+    /**
+     * @brief Delineate the watersheds of many pour points at once.
+     *
+     * Every cell is labeled with the index (in pourPoints) of the first pour
+     * point its steepest-descent path reaches, so nested basins end at the
+     * nearest downstream outlet. Each pour point's basin is one upstream walk
+     * over the cached inflow index that stops at other pour points; basins
+     * are disjoint, so they are walked in parallel and every cell is visited
+     * once.
+     *
+     * @param pourPoints Outlet cells (i, j). A repeated cell belongs to its first occurrence.
+     * @param type Neighborhood type (D4 or D8).
+     * @param threads Worker threads (0 = all CPUs).
+     * @return Int32 label raster (nodata -1 for cells reaching no pour point),
+     *         with per-label cell counts and bounding boxes.
+     * @throw std::out_of_range if a pour point is outside the raster.
+     */
+    BasinLabels labelBasins(const std::vector<std::pair<int,int>>& pourPoints,
+                            FlowDirType type = FlowDirType::D8,
+                            int threads = 0) const;
+
+    /**
+     * @brief Height Above Nearest Drainage (HAND).
+     *
+     * Stream cells are those whose flowAccumulation(type) reaches
+     * minContributingArea. Every other cell is followed down its flow path to
+     * the first stream cell, and its HAND is the elevation difference. Computed
+     * in one linear pass from the streams upstream over the inflow index, where
+     * each cell inherits its drainage cell from its receiver. The stream
+     * cells are split into row bands handled on separate threads; their
+     * upstream trees are disjoint, so no cell is written twice.
+     *
+     * @param minContributingArea Smallest upslope area of a stream cell, in map units squared.
+     * @param type Neighborhood type (D4 or D8).
+     * @param threads Worker threads (0 = all CPUs).
+     * @return Float32 HAND (NaN where no stream is reached) and the Int32 index
+     *         j * width + i of each cell's drainage cell (nodata -1).
+     * @throw std::runtime_error if the raster has 2^31 cells or more (the ids would not fit).
+     */
+    DrainageHeight heightAboveNearestDrainage(double minContributingArea,
+                                              FlowDirType type = FlowDirType::D8,
+                                              int threads = 0) const;
+
+    /**
+     * @brief Extract the multiple-flow-direction watershed of a target cell.
+     *
+     * A cell belongs to it if some strictly descending path leads from the
+     * cell to the target. Found by one iterative upstream walk.
+     *
+     * @return Raster of the same extent; inside = DEM values, outside = NaN.
+     */
     GeoTiffHandler watershedMFD(int itarget, int jtarget, FlowDirType type = FlowDirType::D4) const;
+
+    /**
+     * @brief MFD watershed of a target cell, as a mask and a contribution fraction per cell.
+     *
+     * Flow leaves each cell toward all lower neighbors in proportion to
+     * (drop / distance)^exponent, as in flowAccumulationMFD. The fraction of
+     * a cell is the part of its flow that reaches the target (1 at the
+     * target, 0 outside the watershed). Computed without recursion: one
+     * upstream walk for the mask, then one topologically ordered pass
+     * (Kahn's algorithm) over the watershed cells for the fractions.
+     *
+     * @throw std::out_of_range if the target is outside the raster.
+     */
+    MFDContribution watershedMFDContribution(int itarget, int jtarget,
+                                             FlowDirType type = FlowDirType::D8,
+                                             double exponent = 1.1) const;
+
+    /** @name Windows */
+    ///@{
+    /**
+     * @brief Zero-copy view of a window of this raster.
+     * @throw std::out_of_range if the window exceeds the raster.
+     */
+    RasterView view(int i0, int j0, int width, int height) const;
+
+    /**
+     * @brief Zero-copy view of the bounding box of the valid cells.
+     * @param nodataThreshold Cells equal to this value also count as invalid (ignored if NaN).
+     * @throw std::runtime_error if no cell is valid.
+     */
+    RasterView croppedView(double nodataThreshold) const;
+
+    /**
+     * @brief Copy of a window of this raster, in memory and keeping the pixel type.
+     * @throw std::out_of_range if the window exceeds the raster.
+     */
+    GeoTiffHandler subset(int i0, int j0, int width, int height) const;
+
+    /// Materialized croppedView(nodataThreshold).
     GeoTiffHandler cropMasked(double nodataThreshold) const;
+    ///@}
 
     static std::vector<std::vector<std::vector<std::pair<int,int>>>> buildInflowMFD(
-        const std::vector<std::vector<double>>& dem,
-        int width, int height,
+        RasterSpan<const float> dem,
         FlowDirType type);
 
+    /// True if a strictly descending path leads from (i0, j0) to (itarget, jtarget).
     bool drainsToMFD(int i0, int j0, int itarget, int jtarget, FlowDirType type) const;
 
 
     Path downstreamPath(int i0, int j0, FlowDirType type) const;
+
+    /// Which way flowLength measures along the flow paths.
+    enum class FlowLength {
+        Downstream,  ///< From each cell down to the end of its flow path (outlet or pit).
+        Upstream     ///< From the farthest cell upstream down to each cell.
+    };
+
+    /**
+     * @brief Flow-length raster along flowDirections(type).
+     *
+     * Each step between neighboring cells counts its map distance (diagonals
+     * included) times the mean weight of the two cells, so a roughness or
+     * inverse-velocity raster turns lengths into relative travel times. All
+     * cells are ordered once by a breadth-first walk up from the flow-path
+     * ends over the inflow index; downstream lengths follow in that order and
+     * upstream lengths in reverse, so the cost is linear.
+     *
+     * @param direction Downstream or Upstream.
+     * @param type Neighborhood type (D4 or D8).
+     * @param weights Optional per-cell weights on the same grid (NaN counts as 1).
+     * @return Float32 flow lengths (NaN at nodata cells).
+     * @throw std::invalid_argument if weights has a different size.
+     */
+    GeoTiffHandler flowLength(FlowLength direction, FlowDirType type = FlowDirType::D8,
+                              const GeoTiffHandler* weights = nullptr) const;
+
+    /**
+     * @brief Longest flow path ending at a pour point.
+     *
+     * Starts at the cell of the pour point's watershed with the largest
+     * (weighted, as in flowLength) downstream length to it and follows the
+     * flow directions down to the pour point. Each point carries that
+     * length in its "flow_length" attribute.
+     *
+     * @param i,j Pour point cell.
+     * @param type Neighborhood type (D4 or D8).
+     * @param weights Optional per-cell weights on the same grid (NaN counts as 1).
+     * @return Cell centers from the most remote cell to the pour point.
+     * @throw std::out_of_range if the pour point is outside the raster.
+     * @throw std::invalid_argument if weights has a different size.
+     */
+    Polyline longestFlowPath(int i, int j, FlowDirType type = FlowDirType::D8,
+                             const GeoTiffHandler* weights = nullptr) const;
     /**
      * @brief Compute the watershed for a target cell. If its size exceeds minSize,
      *        return it immediately. Otherwise, evaluate all D8 neighbors and return
@@ -369,7 +804,7 @@ public:
      * of its valid neighbors (D4 or D8).
      *
      * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
-     * @return A new GeoTiffHandler object where sinks are marked as 1.0, others as 0.0.
+     * @return A new UInt8 GeoTiffHandler object where sinks are marked as 1, others as 0.
      */
     GeoTiffHandler detectSinks(FlowDirType type = FlowDirType::D8) const;
 
@@ -377,6 +812,7 @@ public:
      * @brief Iteratively fill single-pixel sinks by replacing them with the average of their neighbors.
      *
      * Boundary pixels are never modified. Iterates until no sinks remain or maxIter is reached.
+     * Multi-cell depressions are not resolved; prefer fillDepressions().
      *
      * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
      * @param maxIter Maximum iterations (default 1000).
@@ -384,6 +820,60 @@ public:
      */
     GeoTiffHandler fillSinksIterative(FlowDirType type = FlowDirType::D8, int maxIter = 1000) const;
 
+    /// How fillDepressions levels a filled depression.
+    enum class FillMode {
+        Flat,    ///< Raise to the spill elevation, leaving flat areas (flowDirections routes across them).
+        Epsilon  ///< Raise to a tiny (one float ulp per cell) gradient toward the outlet, so every cell drains.
+    };
+
+    /**
+     * @brief Fill every depression, of any size, in a single priority-flood pass.
+     *
+     * Barnes et al. (2014) Priority-Flood: starting from the raster boundary
+     * and cells next to nodata, cells are visited in order of elevation and
+     * any cell lower than the cell it was reached from is raised to it. Cells
+     * inside a depression bypass the priority queue through a plain FIFO,
+     * so the cost is O(N log N) for the cells on slopes and O(N) in pits.
+     * Afterwards every valid cell has a non-ascending (Flat) or strictly
+     * descending (Epsilon) path to the boundary or to nodata.
+     *
+     * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
+     * @param mode Flat or Epsilon leveling.
+     * @param fillDepth If not null, receives a Float32 raster of filled - original (NaN for nodata).
+     * @return A new Float32 GeoTiffHandler with depressions filled.
+     */
+    GeoTiffHandler fillDepressions(FlowDirType type = FlowDirType::D8,
+                                   FillMode mode = FillMode::Flat,
+                                   GeoTiffHandler* fillDepth = nullptr) const;
+
+    /**
+     * @brief Remove depressions by carving least-cost channels out of them instead of raising terrain.
+     *
+     * Lindsay's least-cost breaching: pits (cells without a lower neighbor,
+     * away from the boundary and nodata) are processed from the lowest up.
+     * From each pit a Dijkstra search, bounded by maxLength and maxDepth,
+     * finds the cheapest path to a cell lower than the pit (or to the
+     * boundary or nodata), where crossing a cell costs its height above the
+     * pit times the step length. That path is lowered to descend strictly
+     * from the pit to its outlet, so embankments are cut through rather
+     * than turned into lakes. Pits already drained by an earlier channel are
+     * skipped. Search state is stamped per pit rather than cleared, so each
+     * search costs only the cells it visits: the many shallow pits of a noisy
+     * DEM are cheap, while a deep depression without maxLength may search a
+     * large part of the grid.
+     *
+     * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
+     * @param maxDepth Deepest cut allowed below the original terrain (infinity = no limit).
+     * @param maxLength Longest channel in cells (0 = no limit).
+     * @param fill Afterwards fill depressions that could not be breached (fillDepressions, FillMode::Flat).
+     * @param change If not null, receives a Float32 raster of result - original (NaN for nodata).
+     * @return A new Float32 GeoTiffHandler with depressions breached.
+     */
+    GeoTiffHandler breachDepressions(FlowDirType type = FlowDirType::D8,
+                                     double maxDepth = std::numeric_limits<double>::infinity(),
+                                     int maxLength = 0, bool fill = true,
+                                     GeoTiffHandler* change = nullptr) const;
+
     /**
      * @brief Count the number of non-NaN cells in the raster.
      * @return Number of valid cells.
@@ -396,11 +886,17 @@ public:
      * Flow is proportionally distributed to all downslope neighbors.
      * Each cell contributes 1 (itself) plus inflow from upslope neighbors.
      *
+     * Cells are ordered by dependency counting rather than a global sort and
+     * routed without per-cell allocation; with several threads the grid is
+     * processed tile by tile (see accumulateFlowMFD).
+     *
      * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
      * @param exponent Exponent on slope weighting (default 1.1, common in literature).
+     * @param threads Worker threads (0 = all CPUs).
      * @return A new GeoTiffHandler with flow accumulation values.
      */
-    GeoTiffHandler flowAccumulationMFD(FlowDirType type = FlowDirType::D8, double exponent = 1.1) const;
+    GeoTiffHandler flowAccumulationMFD(FlowDirType type = FlowDirType::D8, double exponent = 1.1,
+                                       int threads = 0) const;
 
     enum class FilterMode { Greater, Smaller };
 
@@ -418,7 +914,7 @@ public:
 
      /**
      * @brief Compute the total area of valid cells.
-     * @return Area = countValidCells() * dx_ * |dy_|
+     * @return Area = countValidCells() * |dx| * |dy|
      */
     double area() const;
 
@@ -523,7 +1019,8 @@ public:
      * @brief Create a raster where each pixel contains the index of the closest polyline.
      * @param polylineSet PolylineSet containing polylines to measure distances to.
      * @param nodataValue Value to assign to pixels where no distance can be calculated (default -1).
-     * @return New GeoTiffHandler with polyline indices as pixel values.
+     * @return New Int32 GeoTiffHandler with polyline indices as pixel values
+     *         (nodataValue is stored as the band nodata).
      * @throw std::runtime_error if coordinate arrays are not initialized or polylineSet is empty.
      */
         GeoTiffHandler closestPolylineRaster(const PolylineSet& polylineSet, double nodataValue = -1.0) const;
@@ -542,16 +1039,90 @@ private:
     int height_;             ///< Raster height in pixels.
     int bands_;              ///< Number of raster bands.
 
-    std::vector<float> data_;                   ///< 1D raster data buffer.
-    std::vector<std::vector<double>> data_2d_;  ///< 2D raster data buffer [i][j].
-    std::vector<double> x_;                     ///< X coordinates of cell centers.
-    std::vector<double> y_;                     ///< Y coordinates of cell centers.
-    double dx_;                                 ///< Cell size in x-direction.
-    double dy_;                                 ///< Cell size in y-direction.
+    PixelBuffer data_;                          ///< Row-major raster data buffer, typed.
+    mutable std::shared_ptr<const ValidityMask> validity_;  ///< Cached validity of data_ (null until built).
+    mutable std::shared_ptr<const RasterBuffer<uint8_t>> flowDirs_[2];  ///< Cached D4, D8 flow directions (null until built).
+    mutable std::shared_ptr<const InflowIndex> inflow_[2];  ///< Cached inverse of flowDirs_ (null until built).
+    mutable std::shared_ptr<const RasterBuffer<float>> flowAngles_;  ///< Cached D-infinity angles (null until built).
+    std::shared_ptr<RasterTileCache> tiles_;    ///< Tile cache in Tiled mode (null otherwise).
+    std::shared_ptr<const GeoReference> geo_;  ///< Shared, immutable geo-referencing.
+
+    using VariableMap = std::map<std::string, std::vector<std::vector<QVariant>>>;
+    std::shared_ptr<VariableMap> variables_;    ///< Named variable arrays for each cell (copy-on-write)
 
-    std::map<std::string, std::vector<std::vector<QVariant>>> variables_;  ///< Named variable arrays for each cell
+    /// Replace the geo-referencing (never modifies an instance other rasters may share).
+    void setGeo(GeoReference geo);
 
+    /// Replace the pixels and drop caches derived from them.
+    void setPixels(PixelBuffer pixels);
+
+    /// Drop the validity mask, flow directions and inflow indices.
+    void dropDerivedCaches();
+
+    /// Pixels for in-place writing; drops caches derived from them.
+    PixelBuffer& mutablePixels();
+
+    /// Writable variable map, detached from any raster it was shared with.
+    VariableMap& mutableVariables();
+
+    /// Throw if the raster is tiled; used by operations that need every pixel in memory.
+    void requireInMemory(const char* operation) const;
+
+    /// Inverse of flowDirections(type), cached alongside it.
+    const InflowIndex& inflowIndex(FlowDirType type) const;
+
+    /**
+     * @brief Flat indices of the cells draining to (itarget, jtarget) along steepest descent.
+     * @param[out] i0,j0,i1,j1 Inclusive bounding box of the cells.
+     * @throw std::out_of_range if the target is outside the raster.
+     */
+    std::vector<uint32_t> watershedCells(int itarget, int jtarget, FlowDirType type,
+                                         int& i0, int& j0, int& i1, int& j1) const;
+
+    /// Window (i0, j0)-(i1, j1) of this raster holding the listed cells, every other cell NaN.
+    GeoTiffHandler maskedCrop(const std::vector<uint32_t>& cells, int i0, int j0, int i1, int j1) const;
+
+    /// Cells with a strictly descending path to (itarget, jtarget), flagged by flat index.
+    std::vector<uint8_t> watershedMFDCells(int itarget, int jtarget, FlowDirType type) const;
+
+    /// Copy of this raster with every cell not flagged in cells set to NaN.
+    GeoTiffHandler maskedCopy(const std::vector<bool>& cells) const;
+
+    /// Steepest-descent code of cell (i, j) from its neighbors alone (Tiled-mode routing, flats unrouted).
+    uint8_t neighborFlowCode(int i, int j, FlowDirType type) const;
+
+    /**
+     * @brief Downstream flow lengths (as in flowLength) to the given path ends.
+     * @param[out] length Per cell: length down to its root (NaN if it drains to none).
+     * @param[out] order Cells reached, each after its receiver.
+     */
+    void flowLengthsTo(const std::vector<uint32_t>& roots, FlowDirType type, const GeoTiffHandler* weights,
+                       std::vector<double>& length, std::vector<uint32_t>& order) const;
+
+    /// Call fn(j, i0, values, count) for every run of pixels along a row, in either access mode.
+    template <typename Fn>
+    void forEachRowSegment(Fn&& fn) const;
+
+
+};
+
+/// Result of GeoTiffHandler::watershedMFDContribution.
+struct MFDContribution {
+    GeoTiffHandler mask;      ///< UInt8: 1 for cells with a descending path to the target, else 0.
+    GeoTiffHandler fraction;  ///< Float32: share of each cell's flow reaching the target (NaN for nodata).
+};
+
+/// Result of GeoTiffHandler::labelBasins.
+struct BasinLabels {
+    GeoTiffHandler labels;              ///< Int32: index of the pour point each cell drains to (-1 = none).
+    std::vector<long long> cellCounts;  ///< Cells per label.
+    std::vector<std::array<int,4>> bounds;  ///< Inclusive (i0, j0, i1, j1) per label; all -1 if empty.
+};
 
+/// Result of GeoTiffHandler::heightAboveNearestDrainage (rasters below 2^31 cells).
+struct DrainageHeight {
+    GeoTiffHandler hand;      ///< Float32: elevation above the drainage cell (NaN if none is reached).
+    GeoTiffHandler drainage;  ///< Int32: index j * width + i of the drainage cell (-1 if none).
 };
 
 #endif // GEOTIFFHANDLER_H
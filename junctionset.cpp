@@ -902,21 +902,23 @@ void JunctionSet::assignElevationToJunctions(const GeoTiffHandler* demPtr, const
         return;
     }
 
-    for (auto& junction : junctions_) {
-        try {
-            // Get elevation at junction location using bilinear interpolation
-            double elevation = demPtr->valueAt(junction.x(), junction.y());
-
-            // Check if elevation is valid (not NaN)
-            if (!std::isnan(elevation)) {
-                junction.setNumericAttribute(attributeName, elevation);
-            } else {
-                // Set as null/invalid if interpolation failed
-                junction.setAttribute(attributeName, QVariant());
-            }
-        } catch (const std::exception& e) {
-            // If interpolation fails, set as null/invalid
-            junction.setAttribute(attributeName, QVariant());
+    // Sample all junction locations in one batch (bilinear interpolation)
+    std::vector<double> xs, ys;
+    xs.reserve(junctions_.size());
+    ys.reserve(junctions_.size());
+    for (const auto& junction : junctions_) {
+        xs.push_back(junction.x());
+        ys.push_back(junction.y());
+    }
+    const std::vector<double> elevations = demPtr->valuesAt(xs, ys);
+
+    for (int k = 0; k < junctions_.size(); ++k) {
+        // Check if elevation is valid (not NaN)
+        if (!std::isnan(elevations[k])) {
+            junctions_[k].setNumericAttribute(attributeName, elevations[k]);
+        } else {
+            // Set as null/invalid if interpolation failed
+            junctions_[k].setAttribute(attributeName, QVariant());
         }
     }
 }
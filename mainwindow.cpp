@@ -188,7 +188,7 @@ void MainWindow::on_Find_Closest_Sewers()
         GeoTiffHandler closestPolylineRaster = inputRaster.closestPolylineRaster(polylines, -1.0);
 
         // Step 7: Save the result
-        closestPolylineRaster.saveAs(folderPath.toStdString() + "closest_areas.tif");
+        closestPolylineRaster.saveAs(folderPath.toStdString() + "closest_areas.tif", GeoTiffWriteOptions::compressed());
 
         qDebug() << closestPolylineRaster.info(folderPath + "closest_areas.tif");
 
@@ -262,9 +262,9 @@ void MainWindow::on_Load_GeoTIFF()
     // Sinks
     GeoTiffHandler sinks = dem_resampled.detectSinks(FlowDirType::D8);
 
-    sinks.saveAs(folderPath.toStdString() + "sinks.tiff");
+    sinks.saveAs(folderPath.toStdString() + "sinks.tiff", GeoTiffWriteOptions::compressed());
 
-    GeoTiffHandler sinks_filled = dem_resampled.fillSinksIterative(FlowDirType::D8);
+    GeoTiffHandler sinks_filled = dem_resampled.fillDepressions(FlowDirType::D8, GeoTiffHandler::FillMode::Epsilon);
 
     sinks_filled.saveAs(folderPath.toStdString() + "sinksfilled.tiff");
 
@@ -289,7 +289,7 @@ void MainWindow::on_Load_GeoTIFF()
 
     // Save masked watershed
     ws.saveAsAscii(folderPath.toStdString() + "watershed_masked.asc", -9999.0);
-    ws.saveAs(folderPath.toStdString() + "watershed_masked.tif");
+    ws.saveAs(folderPath.toStdString() + "watershed_masked.tif", GeoTiffWriteOptions::compressed());
 
     // Crop watershed
     GeoTiffHandler wsCrop = ws.cropMasked(-9999);
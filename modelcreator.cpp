@@ -120,10 +120,12 @@ QJsonObject ModelCreator::CreateCatchmentBlocks() const {
     double height = 0.7 * dy;
     double area = dx * dy;
 
+    const RasterBuffer<float> z = dem_.pixels().toFloat();  // any pixel type; nodata reads as NaN
+
     int count = 0;
     for (int j = 0; j < dem_.height(); ++j) {
         for (int i = 0; i < dem_.width(); ++i) {
-            double val = dem_.data2D()[i][j];
+            double val = z(i, j);
             if (std::isnan(val)) continue; // skip invalid cells
 
             ++count;
@@ -158,9 +160,11 @@ QJsonObject ModelCreator::CreateCatchmentLinks() const {
     double dx = fabs(dem_.dx());
     double dy = fabs(dem_.dy());
 
+    const RasterBuffer<float> z = dem_.pixels().toFloat();  // any pixel type; nodata reads as NaN
+
     for (int j = 0; j < dem_.height(); ++j) {
         for (int i = 0; i < dem_.width(); ++i) {
-            if (std::isnan(dem_.data2D()[i][j])) continue;
+            if (std::isnan(z(i, j))) continue;
 
             QString fromName = QString("Catchment (%1@%2)").arg(i).arg(j);
 
@@ -176,7 +180,7 @@ QJsonObject ModelCreator::CreateCatchmentLinks() const {
                 int ni = i + d[0];
                 int nj = j + d[1];
                 if (ni < 0 || nj < 0 || ni >= dem_.width() || nj >= dem_.height()) continue;
-                if (std::isnan(dem_.data2D()[ni][nj])) continue;
+                if (std::isnan(z(ni, nj))) continue;
 
                 QString toName = QString("Catchment (%1@%2)").arg(ni).arg(nj);
                 QString linkName = fromName + " - " + toName;
@@ -0,0 +1,146 @@
+#include "nativeraster.h"
+#include <QFile>
+#include <QString>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+const char* const NativeRaster::extension = ".scraster";
+
+namespace {
+
+const char kMagic[8] = {'S', 'C', 'R', 'A', 'S', 'T', 'E', 'R'};
+const uint32_t kVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;  // read back differently on the other endianness
+const uint64_t kDataAlignment = 4096;        // pixels start on a page boundary
+
+// Pixel type codes stored in the file (stable, independent of the enum order)
+uint32_t pixelCode(PixelType type) {
+    switch (type) {
+    case PixelType::Float32: return 1;
+    case PixelType::Float64: return 2;
+    case PixelType::UInt8:   return 3;
+    case PixelType::Int16:   return 4;
+    case PixelType::Int32:   return 5;
+    }
+    return 0;
+}
+
+bool pixelTypeFromCode(uint32_t code, PixelType& type) {
+    for (PixelType t : {PixelType::UInt8, PixelType::Int16, PixelType::Int32, PixelType::Float32, PixelType::Float64}) {
+        if (pixelCode(t) == code) { type = t; return true; }
+    }
+    return false;
+}
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t pixelType;
+    int32_t width;
+    int32_t height;
+    uint32_t projectionLength;
+    double geoTransform[6];
+    double nodata;
+    uint64_t dataOffset;
+};
+
+// Keeps the file open for as long as its mapping is in use
+struct Mapping {
+    explicit Mapping(const std::string& filename) : file(QString::fromStdString(filename)) {}
+    ~Mapping() { if (address) file.unmap(address); }
+    QFile file;
+    uchar* address = nullptr;
+};
+
+}
+
+bool NativeRaster::isNativeRaster(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    if (!in.read(magic, sizeof(magic))) return false;
+    return std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+void NativeRaster::write(const std::string& filename,
+                         const PixelBuffer& pixels,
+                         const double geoTransform[6],
+                         const std::string& projection)
+{
+    FileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.byteOrder = kByteOrderMark;
+    h.pixelType = pixelCode(pixels.type());
+    h.width = pixels.width();
+    h.height = pixels.height();
+    h.projectionLength = static_cast<uint32_t>(projection.size());
+    std::memcpy(h.geoTransform, geoTransform, sizeof(h.geoTransform));
+    h.nodata = pixels.noData();
+    const uint64_t used = sizeof(FileHeader) + projection.size();
+    h.dataOffset = (used + kDataAlignment - 1) / kDataAlignment * kDataAlignment;
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Failed to create native raster: " + filename);
+    }
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(projection.data(), projection.size());
+    const std::vector<char> padding(h.dataOffset - used, 0);
+    out.write(padding.data(), padding.size());
+    out.write(static_cast<const char*>(pixels.data()), static_cast<std::streamsize>(pixels.bytes()));
+    if (!out) {
+        throw std::runtime_error("Error writing native raster: " + filename);
+    }
+}
+
+NativeRaster::NativeRaster(const std::string& filename) {
+    FileHeader h;
+    PixelType type = PixelType::Float32;
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+            std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) {
+            throw std::runtime_error("Not a native raster: " + filename);
+        }
+        if (h.byteOrder != kByteOrderMark) {
+            throw std::runtime_error("Native raster was written on a machine of different byte order: " + filename);
+        }
+        if (h.version != kVersion || !pixelTypeFromCode(h.pixelType, type) || h.width < 0 || h.height < 0) {
+            throw std::runtime_error("Unsupported native raster version or pixel type: " + filename);
+        }
+        projection_.resize(h.projectionLength);
+        if (!in.read(&projection_[0], h.projectionLength)) {
+            throw std::runtime_error("Truncated native raster header: " + filename);
+        }
+    }
+    std::memcpy(geoTransform_, h.geoTransform, sizeof(geoTransform_));
+
+    const long long bytes = static_cast<long long>(h.width) * h.height * pixelSize(type);
+    if (bytes == 0) {
+        pixels_.assign(type, h.width, h.height, 0.0);
+        pixels_.setNoData(h.nodata);
+        return;
+    }
+
+    auto mapping = std::make_shared<Mapping>(filename);
+    if (!mapping->file.open(QFile::ReadOnly)) {
+        throw std::runtime_error("Failed to open native raster: " + filename);
+    }
+    if (mapping->file.size() < static_cast<long long>(h.dataOffset) + bytes) {
+        throw std::runtime_error("Truncated native raster: " + filename);
+    }
+
+    // Private mapping: writable in memory, never written back
+    mapping->address = mapping->file.map(h.dataOffset, bytes, QFile::MapPrivateOption);
+    if (!mapping->address) {
+        throw std::runtime_error("Failed to map native raster: " + filename);
+    }
+    void* first = mapping->address;
+    pixels_ = PixelBuffer::adopt(type, h.width, h.height, first, std::move(mapping));
+    pixels_.setNoData(h.nodata);
+}
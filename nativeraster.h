@@ -0,0 +1,72 @@
+#ifndef NATIVERASTER_H
+#define NATIVERASTER_H
+
+#include <string>
+#include "pixelbuffer.h"
+
+/**
+ * @class NativeRaster
+ * @brief Reader/writer for SwiftCatch's native single-band raster format.
+ *
+ * The format is meant as a fast reload cache for rasters that are opened
+ * many times (DEMs, filled DEMs, flow accumulation). A file is a small
+ * fixed header (pixel type, geotransform, nodata, projection length), the
+ * projection WKT, padding to a page boundary and then the raw row-major
+ * pixels in host byte order. Because the pixels are stored exactly as
+ * PixelBuffer keeps them, opening a file just maps it into memory: no
+ * decoding and no copy, and pages are only read when touched.
+ *
+ * Files are not portable between machines of different endianness; they
+ * are rejected on open rather than misread.
+ */
+class NativeRaster {
+public:
+    /// Conventional file extension for native rasters.
+    static const char* const extension;
+
+    /**
+     * @brief Check whether a file starts with the native raster signature.
+     * @param filename Path to test.
+     * @return False for missing or unreadable files.
+     */
+    static bool isNativeRaster(const std::string& filename);
+
+    /**
+     * @brief Write a raster in native format.
+     * @param filename Output path.
+     * @param pixels Pixels of any type; their nodata value is stored too.
+     * @param geoTransform GDAL-style geotransform (6 values).
+     * @param projection Projection WKT (may be empty).
+     * @throw std::runtime_error if the file cannot be written.
+     */
+    static void write(const std::string& filename,
+                      const PixelBuffer& pixels,
+                      const double geoTransform[6],
+                      const std::string& projection);
+
+    /**
+     * @brief Map a native raster into memory.
+     *
+     * The mapping is private: pixels can be modified in memory without
+     * ever touching the file.
+     *
+     * @param filename Path to a file written by write().
+     * @throw std::runtime_error if the file is not a valid native raster.
+     */
+    explicit NativeRaster(const std::string& filename);
+
+    int width() const { return pixels_.width(); }
+    int height() const { return pixels_.height(); }
+    const double* geoTransform() const { return geoTransform_; }
+    const std::string& projection() const { return projection_; }
+
+    /// Mapped pixels; the mapping lives as long as any buffer referring to it.
+    const PixelBuffer& pixels() const { return pixels_; }
+
+private:
+    PixelBuffer pixels_;
+    double geoTransform_[6] = {0, 1, 0, 0, 0, 1};
+    std::string projection_;
+};
+
+#endif // NATIVERASTER_H
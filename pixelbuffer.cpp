@@ -0,0 +1,156 @@
+#include "pixelbuffer.h"
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+namespace {
+
+// Round and clamp to the range of T; NaN becomes the nodata value (0 if none)
+template <typename T>
+T toPixel(double v, double nodata) {
+    if constexpr (std::is_floating_point<T>::value) {
+        return static_cast<T>(v);
+    } else {
+        if (std::isnan(v)) v = std::isnan(nodata) ? 0.0 : nodata;
+        v = std::round(v);
+        v = std::min<double>(std::max<double>(v, std::numeric_limits<T>::lowest()), std::numeric_limits<T>::max());
+        return static_cast<T>(v);
+    }
+}
+
+// Integer cells holding the nodata value read as NaN
+template <typename T>
+double fromPixel(T v, double nodata) {
+    if constexpr (std::is_floating_point<T>::value) {
+        return static_cast<double>(v);
+    } else {
+        return static_cast<double>(v) == nodata ? std::nan("") : static_cast<double>(v);
+    }
+}
+
+template <typename T>
+RasterBuffer<T> filled(int width, int height, double fill, double nodata) {
+    return RasterBuffer<T>(width, height, toPixel<T>(fill, nodata));
+}
+
+}
+
+GDALDataType toGDALDataType(PixelType type) {
+    switch (type) {
+    case PixelType::UInt8:   return GDT_Byte;
+    case PixelType::Int16:   return GDT_Int16;
+    case PixelType::Int32:   return GDT_Int32;
+    case PixelType::Float32: return GDT_Float32;
+    case PixelType::Float64: return GDT_Float64;
+    }
+    return GDT_Float32;
+}
+
+PixelType pixelTypeFromGDAL(GDALDataType type) {
+    switch (type) {
+    case GDT_Byte:    return PixelType::UInt8;
+    case GDT_Int16:   return PixelType::Int16;
+    case GDT_UInt16:
+    case GDT_Int32:   return PixelType::Int32;
+    case GDT_Float32: return PixelType::Float32;
+    default:          return PixelType::Float64;  // UInt32, Float64, complex types
+    }
+}
+
+size_t pixelSize(PixelType type) {
+    switch (type) {
+    case PixelType::UInt8:   return 1;
+    case PixelType::Int16:   return 2;
+    case PixelType::Int32:   return 4;
+    case PixelType::Float32: return 4;
+    case PixelType::Float64: return 8;
+    }
+    return 4;
+}
+
+const char* pixelTypeName(PixelType type) {
+    switch (type) {
+    case PixelType::UInt8:   return "UInt8";
+    case PixelType::Int16:   return "Int16";
+    case PixelType::Int32:   return "Int32";
+    case PixelType::Float32: return "Float32";
+    case PixelType::Float64: return "Float64";
+    }
+    return "Unknown";
+}
+
+PixelBuffer PixelBuffer::adopt(PixelType type, int width, int height, void* pixels, std::shared_ptr<void> owner) {
+    switch (type) {
+    case PixelType::UInt8:   return RasterBuffer<uint8_t>::adopt(width, height, static_cast<uint8_t*>(pixels), std::move(owner));
+    case PixelType::Int16:   return RasterBuffer<int16_t>::adopt(width, height, static_cast<int16_t*>(pixels), std::move(owner));
+    case PixelType::Int32:   return RasterBuffer<int32_t>::adopt(width, height, static_cast<int32_t*>(pixels), std::move(owner));
+    case PixelType::Float32: return RasterBuffer<float>::adopt(width, height, static_cast<float*>(pixels), std::move(owner));
+    case PixelType::Float64: return RasterBuffer<double>::adopt(width, height, static_cast<double*>(pixels), std::move(owner));
+    }
+    throw std::invalid_argument("Unknown pixel type");
+}
+
+void PixelBuffer::assign(PixelType type, int width, int height, double fill) {
+    switch (type) {
+    case PixelType::UInt8:   buffer_ = filled<uint8_t>(width, height, fill, noData_); break;
+    case PixelType::Int16:   buffer_ = filled<int16_t>(width, height, fill, noData_); break;
+    case PixelType::Int32:   buffer_ = filled<int32_t>(width, height, fill, noData_); break;
+    case PixelType::Float32: buffer_ = filled<float>(width, height, fill, noData_); break;
+    case PixelType::Float64: buffer_ = filled<double>(width, height, fill, noData_); break;
+    }
+}
+
+double PixelBuffer::value(int i, int j) const {
+    const double nodata = noData_;
+    return std::visit([i, j, nodata](const auto& b) { return fromPixel(b(i, j), nodata); }, buffer_);
+}
+
+void PixelBuffer::set(int i, int j, double v) {
+    const double nodata = noData_;
+    std::visit([i, j, v, nodata](auto& b) {
+        using T = typename std::decay_t<decltype(b)>::value_type;
+        b(i, j) = toPixel<T>(v, nodata);
+    }, buffer_);
+}
+
+const void* PixelBuffer::data() const {
+    return std::visit([](const auto& b) { return static_cast<const void*>(b.data()); }, buffer_);
+}
+
+void* PixelBuffer::data() {
+    return std::visit([](auto& b) { return static_cast<void*>(b.data()); }, buffer_);
+}
+
+PixelBuffer PixelBuffer::converted(PixelType type) const {
+    if (type == this->type()) return *this;
+
+    PixelBuffer out;
+    const bool toFloat = (type == PixelType::Float32 || type == PixelType::Float64);
+    out.noData_ = toFloat ? std::nan("") : noData_;  // float gaps hold NaN, not the integer sentinel
+    out.assign(type, width(), height(), 0.0);
+    const double nodata = noData_;
+    std::visit([&out, nodata](const auto& src) {
+        out.visit([&src, nodata](auto& dst) {
+            using T = typename std::decay_t<decltype(dst)>::value_type;
+            const auto* s = src.data();
+            T* d = dst.data();
+            for (size_t k = 0; k < src.size(); ++k) d[k] = toPixel<T>(fromPixel(s[k], nodata), nodata);
+        });
+    }, buffer_);
+    return out;
+}
+
+PixelBuffer PixelBuffer::window(int i0, int j0, int w, int h) const {
+    PixelBuffer out;
+    out.noData_ = noData_;
+    out.buffer_ = std::visit([=](const auto& src) -> Variant {
+        using T = typename std::decay_t<decltype(src)>::value_type;
+        RasterSpan<const T> view = src.span().subSpan(i0, j0, w, h);
+        RasterBuffer<T> dst(w, h);
+        for (int j = 0; j < h; ++j) {
+            std::copy(view.row(j), view.row(j) + w, dst.row(j));
+        }
+        return dst;
+    }, buffer_);
+    return out;
+}
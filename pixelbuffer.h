@@ -0,0 +1,142 @@
+#ifndef PIXELBUFFER_H
+#define PIXELBUFFER_H
+
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <variant>
+#include <stdexcept>
+#include <gdal_priv.h>
+#include "rasterbuffer.h"
+
+/// Pixel types a raster can be stored with (declaration order matches PixelBuffer's variant).
+enum class PixelType {
+    UInt8,    ///< Masks, flow directions.
+    Int16,    ///< Integer DEMs.
+    Int32,    ///< Labels and indices.
+    Float32,  ///< Continuous fields (the default).
+    Float64   ///< Continuous fields needing double precision.
+};
+
+template <typename T> struct PixelTraits;
+template <> struct PixelTraits<uint8_t> { static constexpr PixelType type = PixelType::UInt8; };
+template <> struct PixelTraits<int16_t> { static constexpr PixelType type = PixelType::Int16; };
+template <> struct PixelTraits<int32_t> { static constexpr PixelType type = PixelType::Int32; };
+template <> struct PixelTraits<float>   { static constexpr PixelType type = PixelType::Float32; };
+template <> struct PixelTraits<double>  { static constexpr PixelType type = PixelType::Float64; };
+
+/// GDAL data type matching a pixel type.
+GDALDataType toGDALDataType(PixelType type);
+
+/// Narrowest pixel type that holds every value of a GDAL data type.
+PixelType pixelTypeFromGDAL(GDALDataType type);
+
+/// Size of one pixel in bytes.
+size_t pixelSize(PixelType type);
+
+/// Short human-readable name ("UInt8", "Float32", ...).
+const char* pixelTypeName(PixelType type);
+
+/**
+ * @class PixelBuffer
+ * @brief RasterBuffer of a pixel type chosen at run time.
+ *
+ * Categorical rasters (masks, labels, flow directions) are stored with the
+ * narrowest integer type instead of being promoted to float. Typed access
+ * goes through as<T>(); value()/set() convert through double for code that
+ * does not care about the storage type. Copies share pixels copy-on-write,
+ * like RasterBuffer itself.
+ *
+ * Integer buffers may carry a nodata value. It reads back as NaN through
+ * value() and conversions to float, writing NaN through set() stores it,
+ * and it is written as the band nodata when saving. Float buffers use NaN
+ * directly.
+ */
+class PixelBuffer {
+public:
+    using Variant = std::variant<RasterBuffer<uint8_t>, RasterBuffer<int16_t>, RasterBuffer<int32_t>,
+                                 RasterBuffer<float>, RasterBuffer<double>>;
+
+    PixelBuffer() : buffer_(RasterBuffer<float>()) {}
+
+    /// Buffer of the given type with every cell set to fill.
+    PixelBuffer(PixelType type, int width, int height, double fill = 0.0) { assign(type, width, height, fill); }
+
+    /// Wrap a typed buffer (shares its pixels).
+    template <typename T>
+    PixelBuffer(RasterBuffer<T> buffer) : buffer_(std::move(buffer)) {}
+
+    /**
+     * @brief Wrap existing row-major pixels of the given type without copying them.
+     * @see RasterBuffer::adopt
+     */
+    static PixelBuffer adopt(PixelType type, int width, int height, void* pixels, std::shared_ptr<void> owner);
+
+    /// Resize to width x height of the given type and set every cell to fill.
+    void assign(PixelType type, int width, int height, double fill);
+
+    PixelType type() const { return static_cast<PixelType>(buffer_.index()); }
+    int width() const { return std::visit([](const auto& b) { return b.width(); }, buffer_); }
+    int height() const { return std::visit([](const auto& b) { return b.height(); }, buffer_); }
+    size_t size() const { return std::visit([](const auto& b) { return b.size(); }, buffer_); }
+    bool empty() const { return size() == 0; }
+
+    /// Storage size of the pixels in bytes.
+    size_t bytes() const { return size() * pixelSize(type()); }
+
+    template <typename T>
+    bool holds() const { return std::holds_alternative<RasterBuffer<T>>(buffer_); }
+
+    /**
+     * @brief Typed access to the pixels.
+     * @throw std::runtime_error if the buffer holds another pixel type.
+     */
+    template <typename T>
+    RasterBuffer<T>& as() {
+        if (!holds<T>()) throw std::runtime_error(std::string("PixelBuffer holds ") + pixelTypeName(type()) +
+                                                  " pixels, not " + pixelTypeName(PixelTraits<T>::type));
+        return std::get<RasterBuffer<T>>(buffer_);
+    }
+
+    template <typename T>
+    const RasterBuffer<T>& as() const { return const_cast<PixelBuffer*>(this)->as<T>(); }
+
+    /// Apply fn to the typed RasterBuffer.
+    template <typename Fn>
+    decltype(auto) visit(Fn&& fn) { return std::visit(std::forward<Fn>(fn), buffer_); }
+
+    template <typename Fn>
+    decltype(auto) visit(Fn&& fn) const { return std::visit(std::forward<Fn>(fn), buffer_); }
+
+    /// Value of cell (i, j) converted to double (NaN for integer nodata).
+    double value(int i, int j) const;
+
+    /// Store v at cell (i, j); integer types round, and store nodata for NaN.
+    void set(int i, int j, double v);
+
+    /// Raw pixel memory (row-major, type() elements).
+    const void* data() const;
+    void* data();
+
+    double noData() const { return noData_; }
+    bool hasNoData() const { return !std::isnan(noData_); }
+    void setNoData(double nodata) { noData_ = nodata; }
+
+    /// Copy converted to another type (shares pixels if the type already matches); float results take NaN as nodata.
+    PixelBuffer converted(PixelType type) const;
+
+    /// Pixels as Float32; free (shared) when they already are.
+    RasterBuffer<float> toFloat() const { return converted(PixelType::Float32).as<float>(); }
+
+    /**
+     * @brief Copy of a rectangular window, keeping the pixel type.
+     * @throw std::out_of_range if the window exceeds the buffer.
+     */
+    PixelBuffer window(int i0, int j0, int w, int h) const;
+
+private:
+    Variant buffer_;
+    double noData_ = std::nan("");
+};
+
+#endif // PIXELBUFFER_H
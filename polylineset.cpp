@@ -8,6 +8,7 @@
 #include <numeric>
 #include <limits>
 #include <cmath>
+#include <unordered_map>
 // Core GDAL includes
 #include <gdal.h>
 #include <gdal_priv.h>
@@ -1429,6 +1430,10 @@ void PolylineSet::calculateProjectedSlopes(const GeoTiffHandler* demPtr, const s
 
     ensureAttributeVectorSize(polylines_.size());
 
+    // Polylines still needing a slope, their unit directions and centroids
+    std::vector<size_t> pending;
+    std::vector<double> unitX, unitY, xs, ys;
+
     for (size_t i = 0; i < polylines_.size(); ++i) {
         const auto& polyline = polylines_[i];
 
@@ -1462,25 +1467,31 @@ void PolylineSet::calculateProjectedSlopes(const GeoTiffHandler* demPtr, const s
             continue;
         }
 
-        // Normalize direction vector
-        double unit_x = dx_line / line_length;
-        double unit_y = dy_line / line_length;
+        // Normalize direction vector; the slope is sampled below for all centroids at once
+        pending.push_back(i);
+        unitX.push_back(dx_line / line_length);
+        unitY.push_back(dy_line / line_length);
+        xs.push_back(centroid.x);
+        ys.push_back(centroid.y);
+    }
+
+    // Get slope components at the centroids from DEM (NaN pairs where unavailable)
+    const std::vector<std::pair<double,double>> slopes = demPtr->slopesAtBilinear(xs, ys);
 
-        // Get slope components at the centroid from DEM
-        // This now returns NaN gracefully instead of throwing
-        auto [slope_x, slope_y] = demPtr->slopeAtBilinear(centroid.x, centroid.y);
+    for (size_t k = 0; k < pending.size(); ++k) {
+        auto [slope_x, slope_y] = slopes[k];
 
         // Check if slope calculation returned valid values
         if (std::isnan(slope_x) || std::isnan(slope_y)) {
-            numeric_attributes_[i][attributeName] = std::nan("");
+            numeric_attributes_[pending[k]][attributeName] = std::nan("");
             continue;
         }
 
         // Project slope onto the line direction using dot product
-        double projected_slope = slope_x * unit_x + slope_y * unit_y;
+        double projected_slope = slope_x * unitX[k] + slope_y * unitY[k];
 
         // Store the result
-        numeric_attributes_[i][attributeName] = projected_slope;
+        numeric_attributes_[pending[k]][attributeName] = projected_slope;
     }
 }
 
@@ -1786,7 +1797,9 @@ PolylineSet PolylineSet::filterByValidDEMCells(const GeoTiffHandler* demPtr, dou
 
     PolylineSet result;
 
-    // Filter polylines based on centroid validity
+    // Centroids of the candidate polylines
+    std::vector<size_t> candidates;
+    std::vector<double> xs, ys;
     for (size_t i = 0; i < polylines_.size(); ++i) {
         const auto& polyline = polylines_[i];
 
@@ -1803,11 +1816,19 @@ PolylineSet PolylineSet::filterByValidDEMCells(const GeoTiffHandler* demPtr, dou
             // If centroid calculation fails, skip this polyline
             continue;
         }
+        candidates.push_back(i);
+        xs.push_back(centroid.x);
+        ys.push_back(centroid.y);
+    }
 
-        // Check if centroid is on a valid DEM cell
-        double centroidElevation = demPtr->valueAt(centroid.x, centroid.y);
+    // Check in one batch whether each centroid is on a valid DEM cell
+    const std::vector<double> centroidElevations = demPtr->valuesAt(xs, ys);
 
-        if (std::isnan(centroidElevation)) {
+    // Filter polylines based on centroid validity
+    for (size_t k = 0; k < candidates.size(); ++k) {
+        const size_t i = candidates[k];
+
+        if (std::isnan(centroidElevations[k])) {
             // Centroid is on null cell, skip this polyline
             continue;
         }
@@ -2138,6 +2159,83 @@ void PolylineSet::recalculateFlowDirections() {
 }
 
 
+size_t PolylineSet::calculateStreamOrders(const std::string& strahlerName, const std::string& shreveName) {
+    const size_t n = polylines_.size();
+
+    // Compact junction indices for the u_node / d_node of every polyline (-1 = none)
+    std::unordered_map<int, int> junctionIndex;
+    auto junctionOf = [&](size_t polyIdx, const char* attribute) {
+        auto nodeStr = getPolylineStringAttribute(polyIdx, attribute);
+        if (!nodeStr || nodeStr->empty()) return -1;
+        try {
+            return junctionIndex.emplace(std::stoi(*nodeStr), static_cast<int>(junctionIndex.size())).first->second;
+        } catch (...) {
+            return -1;
+        }
+    };
+    std::vector<int> up(n), down(n);
+    for (size_t i = 0; i < n; ++i) {
+        up[i] = junctionOf(i, "u_node");
+        down[i] = junctionOf(i, "d_node");
+    }
+    const size_t junctions = junctionIndex.size();
+
+    // Reaches entering and leaving every junction (leaving ones as a compressed list)
+    std::vector<int> incoming(junctions, 0);
+    std::vector<size_t> outBegin(junctions + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        if (down[i] >= 0) ++incoming[down[i]];
+        if (up[i] >= 0) ++outBegin[up[i] + 1];
+    }
+    for (size_t k = 0; k < junctions; ++k) outBegin[k + 1] += outBegin[k];
+    std::vector<size_t> outgoing(outBegin.back());
+    std::vector<size_t> next(outBegin.begin(), outBegin.end() - 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (up[i] >= 0) outgoing[next[up[i]]++] = i;
+    }
+
+    // Per junction: largest incoming Strahler order, how often it arrives, and the Shreve sum
+    std::vector<int> maxOrder(junctions, 0), maxCount(junctions, 0);
+    std::vector<double> shreveSum(junctions, 0.0);
+    std::vector<int> pending(junctions);
+    std::vector<size_t> queue;
+    for (size_t k = 0; k < junctions; ++k) {
+        pending[k] = incoming[k];
+        if (incoming[k] == 0) queue.insert(queue.end(), outgoing.begin() + outBegin[k], outgoing.begin() + outBegin[k + 1]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (up[i] < 0) queue.push_back(i);
+    }
+
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const size_t i = queue[head];
+        const int u = up[i];
+        int strahler = 1;
+        double shreve = 1.0;
+        if (u >= 0 && incoming[u] > 0) {
+            strahler = maxOrder[u] + (maxCount[u] >= 2 ? 1 : 0);
+            shreve = shreveSum[u];
+        }
+        setPolylineNumericAttribute(i, strahlerName, strahler);
+        setPolylineNumericAttribute(i, shreveName, shreve);
+
+        const int d = down[i];
+        if (d < 0) continue;
+        if (strahler > maxOrder[d]) {
+            maxOrder[d] = strahler;
+            maxCount[d] = 1;
+        } else if (strahler == maxOrder[d]) {
+            ++maxCount[d];
+        }
+        shreveSum[d] += shreve;
+        if (--pending[d] == 0) {
+            queue.insert(queue.end(), outgoing.begin() + outBegin[d], outgoing.begin() + outBegin[d + 1]);
+        }
+    }
+
+    return queue.size();
+}
+
 PolylineSet PolylineSet::traceAndCorrectDownstreamPath(int startJunctionId, double elevationOffset, int maxSteps) {
     PolylineSet result;
 
@@ -2552,3 +2650,92 @@ PolylineSet PolylineSet::fromPolyline(const Polyline& polyline) {
     set.addPolyline(polyline);
     return set;
 }
+
+PolylineSet PolylineSet::extractStreams(const GeoTiffHandler* demPtr, double minContributingArea,
+                                        FlowDirType type) {
+    if (!demPtr) {
+        throw std::runtime_error("GeoTiffHandler pointer is null");
+    }
+    const GeoTiffHandler& dem = *demPtr;
+    const int width = dem.width(), height = dem.height();
+    const RasterBuffer<uint8_t>& codes = dem.flowDirections(type);
+    const GeoTiffHandler accumulation = dem.flowAccumulation(type);
+    const float* area = accumulation.data1D();
+
+    // Stream donors per stream cell (kNotStream elsewhere); receivers of stream cells are stream cells
+    const uint8_t kNotStream = 255;
+    std::vector<uint8_t> donors(static_cast<size_t>(width) * height, kNotStream);
+    for (size_t k = 0; k < donors.size(); ++k) {
+        if (codes.data()[k] != kFlowNoData && area[k] >= minContributingArea) donors[k] = 0;
+    }
+    auto downstream = [&](uint32_t k) -> int64_t {
+        int di, dj;
+        if (!flowOffset(codes.data()[k], di, dj)) return -1;
+        const int64_t r = static_cast<int64_t>(k) + static_cast<int64_t>(dj) * width + di;
+        return donors[r] == kNotStream ? -1 : r;
+    };
+    for (uint32_t k = 0; k < donors.size(); ++k) {
+        if (donors[k] == kNotStream) continue;
+        const int64_t r = downstream(k);
+        if (r >= 0) ++donors[r];
+    }
+
+    PolylineSet result;
+    std::unordered_map<uint32_t, int> junctionAt;  // cell -> junction id
+    std::vector<uint32_t> junctionCells;
+    std::vector<std::vector<size_t>> junctionPolylines;
+    auto junctionId = [&](uint32_t k) {
+        auto [it, added] = junctionAt.emplace(k, static_cast<int>(junctionCells.size()));
+        if (added) {
+            junctionCells.push_back(k);
+            junctionPolylines.emplace_back();
+        }
+        return it->second;
+    };
+
+    // One reach from every head and confluence down to the next confluence or outlet
+    for (uint32_t k = 0; k < donors.size(); ++k) {
+        if (donors[k] == kNotStream || donors[k] == 1 || downstream(k) < 0) continue;
+
+        Polyline line;
+        line.addPoint(dem.x()[k % width], dem.y()[k / width]);
+        uint32_t c = k;
+        for (int64_t r = downstream(c); r >= 0; r = downstream(c)) {
+            c = static_cast<uint32_t>(r);
+            line.addPoint(dem.x()[c % width], dem.y()[c / width]);
+            if (donors[c] != 1) break;  // confluence
+        }
+
+        const int up = junctionId(k), down = junctionId(c);
+        const size_t index = result.size();
+        result.addPolyline(std::move(line));
+        result.setPolylineStringAttribute(index, "u_node", QString::number(up).toStdString());
+        result.setPolylineStringAttribute(index, "d_node", QString::number(down).toStdString());
+        result.setPolylineNumericAttribute(index, "contributing_area", area[c]);
+        junctionPolylines[up].push_back(index);
+        junctionPolylines[down].push_back(index);
+    }
+
+    for (size_t id = 0; id < junctionCells.size(); ++id) {
+        const uint32_t k = junctionCells[id];
+        const int i = static_cast<int>(k % width), j = static_cast<int>(k / width);
+        Junction junction(QPointF(dem.x()[i], dem.y()[j]));
+        junction.setIntAttribute("id", static_cast<int>(id));
+        const double elevation = dem.cellValue(i, j);
+        if (!std::isnan(elevation)) {
+            junction.setNumericAttribute("elevation", elevation);
+        }
+        for (size_t polylineIndex : junctionPolylines[id]) {
+            junction.addConnectedPolyline(std::make_shared<Polyline>(result.polylines_[polylineIndex]));
+        }
+        const size_t count = junctionPolylines[id].size();
+        junction.setIntAttribute("polyline_count", static_cast<int>(count));
+        junction.setStringAttribute("type",
+                                    downstream(k) < 0 ? "outlet" :
+                                        count == 1 ? "headwater" :
+                                        (count == 2 ? "connection" : "branch"));
+        result.junctions_.addJunction(std::move(junction));
+    }
+
+    return result;
+}
@@ -17,6 +17,7 @@ class GDALDataset;
 class OGRLayer;
 class OGRFeature;
 class GeoTiffHandler;
+enum class FlowDirType;
 
 /// \brief Container class for managing multiple polylines with per-polyline attributes
 class PolylineSet: public GeometryBase {
@@ -176,6 +177,23 @@ public:
     void iterativelyCorrectSinks(double elevationOffset = 0.01, int maxIterations = 100);
     void recalculateFlowDirections();
 
+    /**
+     * @brief Strahler and Shreve stream orders from the u_node/d_node topology.
+     *
+     * One topological sweep from the headwaters down: a reach whose upstream
+     * junction receives no reach has order 1; otherwise its Strahler order is
+     * the largest incoming order, plus one if that order arrives at least
+     * twice, and its Shreve order is the sum of the incoming orders. Linear
+     * in the number of polylines. Polylines on a cycle, or downstream of one,
+     * get no order.
+     *
+     * @param strahlerName Numeric attribute receiving the Strahler order.
+     * @param shreveName Numeric attribute receiving the Shreve magnitude.
+     * @return Number of polylines ordered.
+     */
+    size_t calculateStreamOrders(const std::string& strahlerName = "strahler_order",
+                                 const std::string& shreveName = "shreve_order");
+
     PolylineSet traceAndCorrectDownstreamPath(int startJunctionId, double elevationOffset, int maxSteps = 10000);
 
     void correctSinksByTopologicalTraversal(double elevationOffset, int maxIterations = 100);
@@ -187,6 +205,27 @@ public:
 
     static PolylineSet fromPolyline(const Polyline& polyline);
 
+    /**
+     * @brief Extract the stream network of a DEM along its flow directions.
+     *
+     * Stream cells are those whose flow accumulation (upslope area, see
+     * GeoTiffHandler::flowAccumulation) reaches minContributingArea. They are
+     * traced downstream along GeoTiffHandler::flowDirections, one polyline of
+     * cell centers per reach between heads, confluences and outlets, in time
+     * linear in the number of stream cells. Junctions are created at every
+     * reach end with "id" (its index), "elevation" (DEM cell value),
+     * "polyline_count" and "type" (headwater, connection, branch or outlet),
+     * and every polyline gets "u_node"/"d_node" in flow direction plus a
+     * numeric "contributing_area" at its downstream end.
+     *
+     * @param demPtr DEM (ideally depression-filled).
+     * @param minContributingArea Smallest upslope area of a stream cell, in map units squared.
+     * @param type Neighborhood type: FlowDirType::D4 or FlowDirType::D8.
+     * @throw std::runtime_error if demPtr is null.
+     */
+    static PolylineSet extractStreams(const GeoTiffHandler* demPtr, double minContributingArea,
+                                      FlowDirType type);
+
 private:
     std::vector<Polyline> polylines_;
     JunctionSet junctions_;
@@ -0,0 +1,159 @@
+#ifndef RASTERBUFFER_H
+#define RASTERBUFFER_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <stdexcept>
+
+/**
+ * @class RasterSpan
+ * @brief Non-owning, strided 2D view over row-major pixel memory.
+ *
+ * Element (i, j) lives at origin[j * stride + i], where i is the column
+ * index (x) and j is the row index (y), matching the indexing used
+ * throughout GeoTiffHandler. A span never owns or copies pixels, so
+ * sub-windows can be taken for free.
+ */
+template <typename T>
+class RasterSpan {
+public:
+    RasterSpan() = default;
+
+    /**
+     * @brief Construct a view over existing memory.
+     * @param origin Pointer to element (0, 0).
+     * @param width Number of columns.
+     * @param height Number of rows.
+     * @param stride Distance (in elements) between the starts of two rows.
+     */
+    RasterSpan(T* origin, int width, int height, std::ptrdiff_t stride)
+        : origin_(origin), width_(width), height_(height), stride_(stride) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    std::ptrdiff_t stride() const { return stride_; }
+    bool empty() const { return width_ <= 0 || height_ <= 0; }
+
+    /// True when rows follow each other without padding.
+    bool contiguous() const { return stride_ == width_; }
+
+    T& operator()(int i, int j) const { return origin_[j * stride_ + i]; }
+
+    /// Pointer to the first element of row j.
+    T* row(int j) const { return origin_ + j * stride_; }
+
+    /**
+     * @brief View of a rectangular sub-window.
+     * @param i0 First column of the window.
+     * @param j0 First row of the window.
+     * @param w Window width.
+     * @param h Window height.
+     * @throw std::out_of_range if the window exceeds the view.
+     */
+    RasterSpan subSpan(int i0, int j0, int w, int h) const {
+        if (i0 < 0 || j0 < 0 || w < 0 || h < 0 || i0 + w > width_ || j0 + h > height_) {
+            throw std::out_of_range("RasterSpan::subSpan: window outside view.");
+        }
+        return RasterSpan(origin_ + j0 * stride_ + i0, w, h, stride_);
+    }
+
+private:
+    T* origin_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    std::ptrdiff_t stride_ = 0;
+};
+
+/**
+ * @class RasterBuffer
+ * @brief Single contiguous, row-major pixel store of type T.
+ *
+ * Replaces the former pair of a flat float vector and a column-of-vectors
+ * double grid: every cell is held exactly once and row scans are
+ * sequential in memory.
+ *
+ * Storage is reference counted and copy-on-write: copying a buffer only
+ * bumps a reference count, and the pixels are duplicated the first time a
+ * non-const accessor is used on a buffer that is still shared. assign()
+ * never copies, it simply drops the shared pixels and allocates new ones.
+ * Pixels may also live in memory owned by someone else (e.g. a mapped
+ * file, see adopt()); the owner is kept alive as long as any buffer uses it.
+ */
+template <typename T>
+class RasterBuffer {
+public:
+    using value_type = T;
+
+    RasterBuffer() = default;
+
+    RasterBuffer(int width, int height, T fill = T()) { assign(width, height, fill); }
+
+    /// Resize to width x height and set every cell to fill (never copies shared pixels).
+    void assign(int width, int height, T fill) {
+        auto v = std::make_shared<std::vector<T>>(
+            static_cast<size_t>(width) * static_cast<size_t>(height), fill);
+        width_ = width;
+        height_ = height;
+        size_ = v->size();
+        pixels_ = std::shared_ptr<T>(v, v->data());
+    }
+
+    /**
+     * @brief Wrap existing row-major pixels without copying them.
+     * @param width Number of columns.
+     * @param height Number of rows.
+     * @param pixels First pixel; must stay valid while owner is alive.
+     * @param owner Object that keeps the memory alive (e.g. a file mapping).
+     *
+     * The memory must be writable by this process (a private mapping is
+     * fine); writes go to it directly once the buffer is no longer shared.
+     */
+    static RasterBuffer adopt(int width, int height, T* pixels, std::shared_ptr<void> owner) {
+        RasterBuffer b;
+        b.width_ = width;
+        b.height_ = height;
+        b.size_ = static_cast<size_t>(width) * static_cast<size_t>(height);
+        b.pixels_ = std::shared_ptr<T>(std::move(owner), pixels);
+        return b;
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /// True if the pixels are currently shared with another buffer.
+    bool isShared() const { return pixels_.use_count() > 1; }
+
+    /// Take a private copy of the pixels if they are shared.
+    void detach() {
+        if (pixels_.use_count() > 1) {
+            auto v = std::make_shared<std::vector<T>>(pixels_.get(), pixels_.get() + size_);
+            pixels_ = std::shared_ptr<T>(v, v->data());
+        }
+    }
+
+    /// Flat index of cell (i, j).
+    size_t index(int i, int j) const { return static_cast<size_t>(j) * width_ + i; }
+
+    T& operator()(int i, int j) { detach(); return pixels_.get()[index(i, j)]; }
+    const T& operator()(int i, int j) const { return pixels_.get()[index(i, j)]; }
+
+    T* data() { detach(); return pixels_.get(); }
+    const T* data() const { return pixels_.get(); }
+
+    T* row(int j) { return data() + static_cast<size_t>(j) * width_; }
+    const T* row(int j) const { return data() + static_cast<size_t>(j) * width_; }
+
+    RasterSpan<T> span() { return RasterSpan<T>(data(), width_, height_, width_); }
+    RasterSpan<const T> span() const { return RasterSpan<const T>(data(), width_, height_, width_); }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    size_t size_ = 0;
+    std::shared_ptr<T> pixels_;  ///< Aliases the owning vector or external memory.
+};
+
+#endif // RASTERBUFFER_H
@@ -0,0 +1,289 @@
+#include "rasterkernels.h"
+#include <cmath>
+#include <cstdint>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RASTERKERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+void RasterStatistics::add(const RowStatistics& row, int i0, int j) {
+    if (row.count == 0) return;
+    if (row.min < min) {
+        min = row.min;
+        minI = i0 + static_cast<int>(row.argmin);
+        minJ = j;
+    }
+    if (row.max > max) {
+        max = row.max;
+        maxI = i0 + static_cast<int>(row.argmax);
+        maxJ = j;
+    }
+    sum += row.sum;
+    count += row.count;
+    mean = sum / static_cast<double>(count);
+}
+
+namespace {
+
+// ---- Scalar versions (also used for the tails of the vector loops) ----
+
+void statisticsTail(const float* v, size_t k, size_t n, RowStatistics& s) {
+    for (; k < n; ++k) {
+        const float x = v[k];
+        if (std::isnan(x)) continue;
+        if (x < s.min) { s.min = x; s.argmin = static_cast<long long>(k); }
+        if (x > s.max) { s.max = x; s.argmax = static_cast<long long>(k); }
+        s.sum += x;
+        ++s.count;
+    }
+}
+
+RowStatistics statisticsScalar(const float* v, size_t n) {
+    RowStatistics s;
+    statisticsTail(v, 0, n, s);
+    return s;
+}
+
+void thresholdTail(const float* in, float* out, size_t k, size_t n, float threshold, bool greater) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (; k < n; ++k) {
+        const float x = in[k];
+        out[k] = (greater ? x > threshold : x < threshold) ? x : nan;
+    }
+}
+
+void thresholdScalar(const float* in, float* out, size_t n, float threshold, bool greater) {
+    thresholdTail(in, out, 0, n, threshold, greater);
+}
+
+void normalizeScalar(float* v, size_t n, float offset, float range) {
+    for (size_t k = 0; k < n; ++k) v[k] = (v[k] - offset) / range;
+}
+
+// Merge per-lane minima/maxima (lane l holds the first extreme among offsets = l mod width)
+void reduceLanes(const float* mins, const int32_t* argmins,
+                 const float* maxs, const int32_t* argmaxs, int lanes, RowStatistics& s) {
+    for (int l = 0; l < lanes; ++l) {
+        if (mins[l] < s.min || (mins[l] == s.min && s.argmin >= 0 && argmins[l] < s.argmin)) {
+            s.min = mins[l];
+            s.argmin = argmins[l];
+        }
+        if (maxs[l] > s.max || (maxs[l] == s.max && s.argmax >= 0 && argmaxs[l] < s.argmax)) {
+            s.max = maxs[l];
+            s.argmax = argmaxs[l];
+        }
+    }
+}
+
+#ifdef RASTERKERNELS_X86
+
+// ---- AVX2: 8 floats per step ----
+
+__attribute__((target("avx2")))
+RowStatistics statisticsAvx2(const float* v, size_t n) {
+    RowStatistics s;
+    __m256 vmin = _mm256_set1_ps(s.min);
+    __m256 vmax = _mm256_set1_ps(s.max);
+    __m256i imin = _mm256_setzero_si256();
+    __m256i imax = _mm256_setzero_si256();
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    long long count = 0;
+
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m256 x = _mm256_loadu_ps(v + k);
+        const __m256 ok = _mm256_cmp_ps(x, x, _CMP_ORD_Q);
+        count += __builtin_popcount(_mm256_movemask_ps(ok));
+
+        const __m256 xz = _mm256_and_ps(x, ok);  // NaN -> 0 for the sum
+        sum0 = _mm256_add_pd(sum0, _mm256_cvtps_pd(_mm256_castps256_ps128(xz)));
+        sum1 = _mm256_add_pd(sum1, _mm256_cvtps_pd(_mm256_extractf128_ps(xz, 1)));
+
+        // Ordered compares are false for NaN, so NaN never wins
+        const __m256 lt = _mm256_cmp_ps(x, vmin, _CMP_LT_OQ);
+        const __m256 gt = _mm256_cmp_ps(x, vmax, _CMP_GT_OQ);
+        vmin = _mm256_blendv_ps(vmin, x, lt);
+        vmax = _mm256_blendv_ps(vmax, x, gt);
+        imin = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(imin), _mm256_castsi256_ps(idx), lt));
+        imax = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(imax), _mm256_castsi256_ps(idx), gt));
+        idx = _mm256_add_epi32(idx, step);
+    }
+
+    alignas(32) float mins[8], maxs[8];
+    alignas(32) int32_t argmins[8], argmaxs[8];
+    alignas(32) double sums[4];
+    _mm256_store_ps(mins, vmin);
+    _mm256_store_ps(maxs, vmax);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(argmins), imin);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(argmaxs), imax);
+    _mm256_store_pd(sums, _mm256_add_pd(sum0, sum1));
+
+    reduceLanes(mins, argmins, maxs, argmaxs, 8, s);
+    s.sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    s.count = count;
+    statisticsTail(v, k, n, s);
+    return s;
+}
+
+__attribute__((target("avx2")))
+void thresholdAvx2(const float* in, float* out, size_t n, float threshold, bool greater) {
+    const __m256 t = _mm256_set1_ps(threshold);
+    const __m256 nan = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m256 x = _mm256_loadu_ps(in + k);
+        const __m256 keep = greater ? _mm256_cmp_ps(x, t, _CMP_GT_OQ) : _mm256_cmp_ps(x, t, _CMP_LT_OQ);
+        _mm256_storeu_ps(out + k, _mm256_blendv_ps(nan, x, keep));
+    }
+    thresholdTail(in, out, k, n, threshold, greater);
+}
+
+__attribute__((target("avx2")))
+void normalizeAvx2(float* v, size_t n, float offset, float range) {
+    const __m256 o = _mm256_set1_ps(offset);
+    const __m256 r = _mm256_set1_ps(range);
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        _mm256_storeu_ps(v + k, _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(v + k), o), r));
+    }
+    for (; k < n; ++k) v[k] = (v[k] - offset) / range;
+}
+
+// ---- AVX-512: 16 floats per step ----
+
+// GCC 12's own AVX-512 headers trip -Wuninitialized (they build results from _mm*_undefined_*)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f")))
+RowStatistics statisticsAvx512(const float* v, size_t n) {
+    RowStatistics s;
+    __m512 vmin = _mm512_set1_ps(s.min);
+    __m512 vmax = _mm512_set1_ps(s.max);
+    __m512i imin = _mm512_setzero_si512();
+    __m512i imax = _mm512_setzero_si512();
+    __m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i step = _mm512_set1_epi32(16);
+    __m512d sum0 = _mm512_setzero_pd();
+    __m512d sum1 = _mm512_setzero_pd();
+    long long count = 0;
+
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        const __m512 x = _mm512_loadu_ps(v + k);
+        const __mmask16 ok = _mm512_cmp_ps_mask(x, x, _CMP_ORD_Q);
+        count += __builtin_popcount(ok);
+
+        const __m512i xz = _mm512_castps_si512(_mm512_maskz_mov_ps(ok, x));  // NaN -> 0 for the sum
+        sum0 = _mm512_add_pd(sum0, _mm512_cvtps_pd(_mm256_castsi256_ps(_mm512_castsi512_si256(xz))));
+        sum1 = _mm512_add_pd(sum1, _mm512_cvtps_pd(_mm256_castsi256_ps(_mm512_extracti64x4_epi64(xz, 1))));
+
+        const __mmask16 lt = _mm512_cmp_ps_mask(x, vmin, _CMP_LT_OQ);
+        const __mmask16 gt = _mm512_cmp_ps_mask(x, vmax, _CMP_GT_OQ);
+        vmin = _mm512_mask_mov_ps(vmin, lt, x);
+        vmax = _mm512_mask_mov_ps(vmax, gt, x);
+        imin = _mm512_mask_mov_epi32(imin, lt, idx);
+        imax = _mm512_mask_mov_epi32(imax, gt, idx);
+        idx = _mm512_add_epi32(idx, step);
+    }
+
+    alignas(64) float mins[16], maxs[16];
+    alignas(64) int32_t argmins[16], argmaxs[16];
+    _mm512_store_ps(mins, vmin);
+    _mm512_store_ps(maxs, vmax);
+    _mm512_store_si512(argmins, imin);
+    _mm512_store_si512(argmaxs, imax);
+
+    reduceLanes(mins, argmins, maxs, argmaxs, 16, s);
+    s.sum = _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+    s.count = count;
+    statisticsTail(v, k, n, s);
+    return s;
+}
+
+__attribute__((target("avx512f")))
+void thresholdAvx512(const float* in, float* out, size_t n, float threshold, bool greater) {
+    const __m512 t = _mm512_set1_ps(threshold);
+    const __m512 nan = _mm512_set1_ps(std::numeric_limits<float>::quiet_NaN());
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        const __m512 x = _mm512_loadu_ps(in + k);
+        const __mmask16 keep = greater ? _mm512_cmp_ps_mask(x, t, _CMP_GT_OQ) : _mm512_cmp_ps_mask(x, t, _CMP_LT_OQ);
+        _mm512_storeu_ps(out + k, _mm512_mask_mov_ps(nan, keep, x));
+    }
+    thresholdTail(in, out, k, n, threshold, greater);
+}
+
+__attribute__((target("avx512f")))
+void normalizeAvx512(float* v, size_t n, float offset, float range) {
+    const __m512 o = _mm512_set1_ps(offset);
+    const __m512 r = _mm512_set1_ps(range);
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        _mm512_storeu_ps(v + k, _mm512_div_ps(_mm512_sub_ps(_mm512_loadu_ps(v + k), o), r));
+    }
+    for (; k < n; ++k) v[k] = (v[k] - offset) / range;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // RASTERKERNELS_X86
+
+// ---- Runtime dispatch ----
+
+struct Kernels {
+    const char* name;
+    RowStatistics (*statistics)(const float*, size_t);
+    void (*threshold)(const float*, float*, size_t, float, bool);
+    void (*normalize)(float*, size_t, float, float);
+};
+
+Kernels selectKernels() {
+#ifdef RASTERKERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {"avx512", statisticsAvx512, thresholdAvx512, normalizeAvx512};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {"avx2", statisticsAvx2, thresholdAvx2, normalizeAvx2};
+    }
+#endif
+    return {"scalar", statisticsScalar, thresholdScalar, normalizeScalar};
+}
+
+const Kernels& kernels() {
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+}
+
+RowStatistics rowStatistics(const float* v, size_t n) {
+    return kernels().statistics(v, n);
+}
+
+void thresholdKernel(const float* in, float* out, size_t n, double threshold, bool greater) {
+    // For float x: x > t exactly when x > (largest float <= t), and
+    // x < t exactly when x < (smallest float >= t)
+    float t = static_cast<float>(threshold);
+    if (greater && t > threshold) t = std::nextafter(t, -std::numeric_limits<float>::infinity());
+    if (!greater && t < threshold) t = std::nextafter(t, std::numeric_limits<float>::infinity());
+    kernels().threshold(in, out, n, t, greater);
+}
+
+void normalizeKernel(float* v, size_t n, float offset, float range) {
+    kernels().normalize(v, n, offset, range);
+}
+
+const char* rasterKernelInstructionSet() {
+    return kernels().name;
+}
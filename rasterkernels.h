@@ -0,0 +1,63 @@
+#ifndef RASTERKERNELS_H
+#define RASTERKERNELS_H
+
+#include <cstddef>
+#include <limits>
+
+/**
+ * @file rasterkernels.h
+ * @brief Vectorized loops over runs of float pixels (NaN = nodata).
+ *
+ * Each kernel has a scalar version and, on x86 with GCC or Clang, AVX2 and
+ * AVX-512 versions compiled with per-function target attributes. The widest
+ * version the CPU supports is picked once, at first use, so the program
+ * still runs on machines without AVX. Results match the scalar loops the
+ * kernels replace: NaN cells are skipped and ties resolve to the first cell.
+ */
+
+/// Statistics of the valid cells of a run of pixels.
+struct RowStatistics {
+    float min = std::numeric_limits<float>::infinity();   ///< Smallest value (+inf if none).
+    float max = -std::numeric_limits<float>::infinity();  ///< Largest value (-inf if none).
+    long long argmin = -1;   ///< Offset of the first smallest value (-1 if none).
+    long long argmax = -1;   ///< Offset of the first largest value (-1 if none).
+    double sum = 0.0;        ///< Sum of valid values.
+    long long count = 0;     ///< Number of valid (non-NaN) values.
+};
+
+/**
+ * @brief Statistics of the valid cells of a raster, from one pass.
+ *
+ * Cell indices are -1 when the raster has no valid cell.
+ */
+struct RasterStatistics {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    int minI = -1, minJ = -1;  ///< First cell holding min.
+    int maxI = -1, maxJ = -1;  ///< First cell holding max.
+    double sum = 0.0;
+    long long count = 0;
+    double mean = std::numeric_limits<double>::quiet_NaN();  ///< sum / count (NaN if count is 0).
+
+    /// Fold in the statistics of n pixels starting at cell (i0, j); later cells lose ties.
+    void add(const RowStatistics& row, int i0, int j);
+};
+
+/// Min, max, their first offsets, sum and count of the valid values in v[0, n) (n < 2^31).
+RowStatistics rowStatistics(const float* v, size_t n);
+
+/**
+ * @brief out[k] = in[k] if in[k] > threshold (greater) or < threshold (!greater), else NaN.
+ *
+ * Compares exactly as against the double threshold. NaN inputs stay NaN;
+ * in and out may be the same array.
+ */
+void thresholdKernel(const float* in, float* out, size_t n, double threshold, bool greater);
+
+/// v[k] = (v[k] - offset) / range, in place (NaN stays NaN).
+void normalizeKernel(float* v, size_t n, float offset, float range);
+
+/// Instruction set the kernels dispatch to: "avx512", "avx2" or "scalar".
+const char* rasterKernelInstructionSet();
+
+#endif // RASTERKERNELS_H
@@ -0,0 +1,204 @@
+#include "rastersampler.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+const size_t kChunk = 256;              // points gathered before one interpolation pass
+const size_t kMinPointsPerThread = 4096;
+
+}
+
+RasterSampler::RasterSampler(const GeoTiffHandler& raster, int threads)
+    : raster_(raster)
+{
+    threads_ = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    if (const RasterTileCache* tiles = raster_.tileCache()) {
+        blockWidth_ = tiles->tileWidth();
+        blockHeight_ = tiles->tileHeight();
+    } else if (raster_.pixelType() == PixelType::Float32) {
+        pixels_ = raster_.data2D();
+    }
+}
+
+bool RasterSampler::locateValue(double x, double y, int& i, int& j, double& fx, double& fy) const {
+    const int width = raster_.width(), height = raster_.height();
+    const double col = (x - raster_.x().front()) / raster_.dx();
+    const double row = (y - raster_.y().front()) / raster_.dy();
+    if (!(col >= 0 && col < width - 1 && row >= 0 && row < height - 1)) return false;  // also rejects NaN
+
+    i = static_cast<int>(std::floor(col));
+    j = static_cast<int>(std::floor(row));
+    fx = col - i;
+    fy = row - j;
+    return true;
+}
+
+bool RasterSampler::locateSlope(double x, double y, int& i, int& j, double& fx, double& fy) const {
+    const int width = raster_.width(), height = raster_.height();
+    const double col = (x - raster_.x().front()) / raster_.dx();
+    const double row = (y - raster_.y().front()) / raster_.dy();
+    if (!(col >= 0.5 && col < width - 0.5 && row >= 0.5 && row < height - 0.5)) return false;
+
+    i = std::max(0, std::min(static_cast<int>(std::floor(col)), width - 2));
+    j = std::max(0, std::min(static_cast<int>(std::floor(row)), height - 2));
+    fx = col - i;
+    fy = row - j;
+    return true;
+}
+
+template <typename Locate>
+std::vector<size_t> RasterSampler::sortedByBlock(const std::vector<double>& xs, const std::vector<double>& ys,
+                                                 Locate locate) const
+{
+    const size_t blocksX = (raster_.width() + blockWidth_ - 1) / blockWidth_;
+    std::vector<std::pair<size_t, size_t>> keyed;  // (block, point)
+    keyed.reserve(xs.size());
+    for (size_t k = 0; k < xs.size(); ++k) {
+        int i, j;
+        double fx, fy;
+        if (!locate(xs[k], ys[k], i, j, fx, fy)) continue;
+        keyed.emplace_back(static_cast<size_t>(j / blockHeight_) * blocksX + i / blockWidth_, k);
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<size_t> order(keyed.size());
+    for (size_t k = 0; k < keyed.size(); ++k) order[k] = keyed[k].second;
+    return order;
+}
+
+template <typename Fn>
+void RasterSampler::parallelFor(size_t n, Fn&& fn) const {
+    const size_t workers = std::min<size_t>(threads_, std::max<size_t>(1, n / kMinPointsPerThread));
+    if (workers <= 1) {
+        fn(size_t(0), n);
+        return;
+    }
+    std::vector<std::thread> pool;
+    pool.reserve(workers);
+    for (size_t w = 0; w < workers; ++w) {
+        pool.emplace_back([&fn, n, w, workers] { fn(n * w / workers, n * (w + 1) / workers); });
+    }
+    for (std::thread& t : pool) t.join();
+}
+
+void RasterSampler::corners(int i, int j, double& z00, double& z10, double& z01, double& z11,
+                            std::shared_ptr<const RasterTile>& tile) const {
+    if (!pixels_.empty()) {
+        const float* r0 = pixels_.row(j) + i;
+        const float* r1 = pixels_.row(j + 1) + i;
+        z00 = r0[0]; z10 = r0[1];
+        z01 = r1[0]; z11 = r1[1];
+        return;
+    }
+    if (const RasterTileCache* tiles = raster_.tileCache()) {
+        // Points come sorted by tile, so the cache (and its lock) is hit once per run of points
+        if (!tile || i < tile->i0 || i >= tile->i0 + tile->width || j < tile->j0 || j >= tile->j0 + tile->height) {
+            tile = tiles->tileFor(i, j);
+        }
+        if (i + 1 < tile->i0 + tile->width && j + 1 < tile->j0 + tile->height) {
+            const RasterSpan<const float> span = tile->span();
+            const float* r0 = span.row(j - tile->j0) + (i - tile->i0);
+            const float* r1 = span.row(j + 1 - tile->j0) + (i - tile->i0);
+            z00 = r0[0]; z10 = r0[1];
+            z01 = r1[0]; z11 = r1[1];
+            return;
+        }
+        // The cell's right or lower neighbors lie across a tile seam: fall through
+    }
+    z00 = raster_.cellValue(i, j);
+    z10 = raster_.cellValue(i + 1, j);
+    z01 = raster_.cellValue(i, j + 1);
+    z11 = raster_.cellValue(i + 1, j + 1);
+}
+
+std::vector<double> RasterSampler::values(const std::vector<double>& xs, const std::vector<double>& ys) const {
+    if (xs.size() != ys.size()) {
+        throw std::invalid_argument("RasterSampler::values: xs and ys differ in size.");
+    }
+    std::vector<double> out(xs.size(), std::nan(""));
+    if (raster_.x().empty() || raster_.y().empty()) return out;
+
+    auto locate = [this](double x, double y, int& i, int& j, double& fx, double& fy) {
+        return locateValue(x, y, i, j, fx, fy);
+    };
+    const std::vector<size_t> order = sortedByBlock(xs, ys, locate);
+
+    parallelFor(order.size(), [&](size_t begin, size_t end) {
+        double q11[kChunk], q21[kChunk], q12[kChunk], q22[kChunk], fx[kChunk], fy[kChunk], v[kChunk];
+        std::shared_ptr<const RasterTile> tile;  // current tile in tiled mode
+        for (size_t c = begin; c < end; c += kChunk) {
+            const size_t n = std::min(kChunk, end - c);
+
+            // Gather: the only scattered memory accesses
+            for (size_t k = 0; k < n; ++k) {
+                const size_t p = order[c + k];
+                int i, j;
+                locateValue(xs[p], ys[p], i, j, fx[k], fy[k]);
+                corners(i, j, q11[k], q21[k], q12[k], q22[k], tile);
+            }
+
+            // Interpolate: straight-line arithmetic, vectorized by the compiler
+            for (size_t k = 0; k < n; ++k) {
+                v[k] = q11[k] * (1 - fx[k]) * (1 - fy[k]) +
+                       q21[k] * fx[k]       * (1 - fy[k]) +
+                       q12[k] * (1 - fx[k]) * fy[k] +
+                       q22[k] * fx[k]       * fy[k];
+            }
+
+            for (size_t k = 0; k < n; ++k) out[order[c + k]] = v[k];  // NaN corners give NaN
+        }
+    });
+    return out;
+}
+
+std::vector<std::pair<double,double>> RasterSampler::slopes(const std::vector<double>& xs,
+                                                            const std::vector<double>& ys) const
+{
+    if (xs.size() != ys.size()) {
+        throw std::invalid_argument("RasterSampler::slopes: xs and ys differ in size.");
+    }
+    std::vector<std::pair<double,double>> out(xs.size(), {std::nan(""), std::nan("")});
+    if (raster_.x().empty() || raster_.y().empty()) return out;
+
+    auto locate = [this](double x, double y, int& i, int& j, double& fx, double& fy) {
+        return locateSlope(x, y, i, j, fx, fy);
+    };
+    const std::vector<size_t> order = sortedByBlock(xs, ys, locate);
+    const double dx = raster_.dx();
+    const double dy = raster_.dy();
+    const double ySign = dy < 0 ? -1.0 : 1.0;
+
+    parallelFor(order.size(), [&](size_t begin, size_t end) {
+        double z00[kChunk], z10[kChunk], z01[kChunk], z11[kChunk], fx[kChunk], fy[kChunk];
+        double sx[kChunk], sy[kChunk];
+        std::shared_ptr<const RasterTile> tile;  // current tile in tiled mode
+        for (size_t c = begin; c < end; c += kChunk) {
+            const size_t n = std::min(kChunk, end - c);
+
+            for (size_t k = 0; k < n; ++k) {
+                const size_t p = order[c + k];
+                int i, j;
+                locateSlope(xs[p], ys[p], i, j, fx[k], fy[k]);
+                corners(i, j, z00[k], z10[k], z01[k], z11[k], tile);
+            }
+
+            for (size_t k = 0; k < n; ++k) {
+                const double dzdxBottom = (z10[k] - z00[k]) / dx;
+                const double dzdxTop    = (z11[k] - z01[k]) / dx;
+                const double dzdyLeft   = (z01[k] - z00[k]) / dy;
+                const double dzdyRight  = (z11[k] - z10[k]) / dy;
+                sx[k] = dzdxBottom * (1 - fy[k]) + dzdxTop * fy[k];
+                sy[k] = ySign * (dzdyLeft * (1 - fx[k]) + dzdyRight * fx[k]);
+            }
+
+            for (size_t k = 0; k < n; ++k) {
+                if (std::isnan(sx[k]) || std::isnan(sy[k])) continue;  // nodata corner
+                out[order[c + k]] = {sx[k], sy[k]};
+            }
+        }
+    });
+    return out;
+}
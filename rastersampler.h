@@ -0,0 +1,73 @@
+#ifndef RASTERSAMPLER_H
+#define RASTERSAMPLER_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "geotiffhandler.h"
+
+/**
+ * @class RasterSampler
+ * @brief Bilinear values and slopes of a raster at many points at once.
+ *
+ * Gives exactly the results of GeoTiffHandler::valueAt and
+ * GeoTiffHandler::slopeAtBilinear, point for point, but samples a whole
+ * batch in one go: points are located once, sorted by raster block (the
+ * tile-cache tile in tiled mode, a 64 x 64 cell block otherwise) so each
+ * block is visited once while it is hot in cache, and the sorted batch is
+ * split across threads. In tiled mode each run of points takes its tile
+ * from the cache once and reads corners from it directly; only cells whose
+ * corners straddle a tile seam go through GeoTiffHandler::cellValue. Corner values are gathered into small contiguous
+ * arrays and interpolated in a separate straight-line loop the compiler
+ * vectorizes.
+ *
+ * The sampler holds a (pixel-sharing) copy of the raster, so it stays valid
+ * independently of the handler it was made from.
+ */
+class RasterSampler {
+public:
+    /**
+     * @param raster Raster to sample (in either access mode).
+     * @param threads Worker threads (0 = all CPUs).
+     */
+    explicit RasterSampler(const GeoTiffHandler& raster, int threads = 0);
+
+    /**
+     * @brief Bilinearly interpolated values at the points (xs[k], ys[k]).
+     * @return One value per point; NaN outside the raster or next to nodata.
+     * @throw std::invalid_argument if xs and ys differ in size.
+     */
+    std::vector<double> values(const std::vector<double>& xs, const std::vector<double>& ys) const;
+
+    /**
+     * @brief Bilinear slopes (dz/dx, dz/dy) at the points (xs[k], ys[k]).
+     * @return One pair per point; NaN pair outside the raster or next to nodata.
+     * @throw std::invalid_argument if xs and ys differ in size.
+     */
+    std::vector<std::pair<double,double>> slopes(const std::vector<double>& xs, const std::vector<double>& ys) const;
+
+private:
+    /// Point k sits in cell (i, j) at fractions (fx, fy); false if it cannot be sampled.
+    bool locateValue(double x, double y, int& i, int& j, double& fx, double& fy) const;
+    bool locateSlope(double x, double y, int& i, int& j, double& fx, double& fy) const;
+
+    /// Indices of the locatable points, sorted by the raster block they fall in.
+    template <typename Locate>
+    std::vector<size_t> sortedByBlock(const std::vector<double>& xs, const std::vector<double>& ys, Locate locate) const;
+
+    /// Call fn(begin, end) on contiguous ranges of [0, n), one per thread.
+    template <typename Fn>
+    void parallelFor(size_t n, Fn&& fn) const;
+
+    /// Corners z00, z10, z01, z11 of cell (i, j); in tiled mode tile holds the last tile used.
+    void corners(int i, int j, double& z00, double& z10, double& z01, double& z11,
+                 std::shared_ptr<const RasterTile>& tile) const;
+
+    GeoTiffHandler raster_;
+    RasterSpan<const float> pixels_;  ///< Direct pixel access (empty unless in memory and Float32).
+    int threads_ = 1;
+    int blockWidth_ = 64;
+    int blockHeight_ = 64;
+};
+
+#endif // RASTERSAMPLER_H
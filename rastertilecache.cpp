@@ -0,0 +1,142 @@
+#include "rastertilecache.h"
+#include <gdal_priv.h>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+// Tiles smaller than this (in cells) are grown vertically, so strip-organized
+// files do not end up with one tiny read per row.
+static const int kMinTileCells = 64 * 1024;
+
+RasterTileCache::RasterTileCache(const std::string& filename, size_t memoryBudgetBytes)
+    : nodata_(std::nan("")), budget_(memoryBudgetBytes)
+{
+    GDALAllRegister();
+    dataset_ = (GDALDataset*) GDALOpen(filename.c_str(), GA_ReadOnly);
+    if (!dataset_) {
+        throw std::runtime_error("Failed to open raster for tiled access: " + filename);
+    }
+
+    band_   = dataset_->GetRasterBand(1);
+    width_  = dataset_->GetRasterXSize();
+    height_ = dataset_->GetRasterYSize();
+
+    int hasNodata = 0;
+    double nd = band_->GetNoDataValue(&hasNodata);
+    if (hasNodata) nodata_ = nd;
+
+    int bx = 0, by = 0;
+    band_->GetBlockSize(&bx, &by);
+    if (bx <= 0 || bx > width_) bx = width_;
+    if (by <= 0) by = 1;
+    if (static_cast<long long>(bx) * by < kMinTileCells) {
+        by = ((kMinTileCells + bx - 1) / bx + by - 1) / by * by;  // whole blocks only
+    }
+    tileWidth_  = bx;
+    tileHeight_ = std::min(by, height_);
+    tilesX_ = (width_  + tileWidth_  - 1) / tileWidth_;
+    tilesY_ = (height_ + tileHeight_ - 1) / tileHeight_;
+}
+
+RasterTileCache::~RasterTileCache() {
+    if (dataset_) {
+        GDALClose(dataset_);
+    }
+}
+
+void RasterTileCache::setMemoryBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evictToBudget();
+}
+
+size_t RasterTileCache::memoryBudget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+size_t RasterTileCache::residentTiles() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tiles_.size();
+}
+
+std::shared_ptr<const RasterTile> RasterTileCache::tile(int tx, int ty) const {
+    if (tx < 0 || tx >= tilesX_ || ty < 0 || ty >= tilesY_) {
+        throw std::out_of_range("Tile coordinates out of range.");
+    }
+    const int key = ty * tilesX_ + tx;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tiles_.find(key);
+    if (it != tiles_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second.position);
+        return it->second.tile;
+    }
+
+    // GDAL handles are not thread-safe, so the read stays under the lock
+    std::shared_ptr<const RasterTile> t = readTile(tx, ty);
+    lru_.push_front(key);
+    tiles_[key] = Entry{t, lru_.begin()};
+    residentBytes_ += t->values.size() * sizeof(float);
+    evictToBudget();
+    return t;
+}
+
+std::shared_ptr<const RasterTile> RasterTileCache::tileFor(int i, int j) const {
+    return tile(i / tileWidth_, j / tileHeight_);
+}
+
+double RasterTileCache::value(int i, int j) const {
+    return tileFor(i, j)->at(i, j);
+}
+
+RasterBuffer<float> RasterTileCache::neighborhood(int i, int j, int radius) const {
+    const int n = 2 * radius + 1;
+    RasterBuffer<float> out(n, n, std::nanf(""));
+    for (int dj = -radius; dj <= radius; ++dj) {
+        int nj = j + dj;
+        if (nj < 0 || nj >= height_) continue;
+        for (int di = -radius; di <= radius; ++di) {
+            int ni = i + di;
+            if (ni < 0 || ni >= width_) continue;
+            out(di + radius, dj + radius) = static_cast<float>(value(ni, nj));
+        }
+    }
+    return out;
+}
+
+std::shared_ptr<const RasterTile> RasterTileCache::readTile(int tx, int ty) const {
+    auto t = std::make_shared<RasterTile>();
+    t->i0 = tx * tileWidth_;
+    t->j0 = ty * tileHeight_;
+    t->width  = std::min(tileWidth_,  width_  - t->i0);
+    t->height = std::min(tileHeight_, height_ - t->j0);
+    t->values.resize(static_cast<size_t>(t->width) * t->height);
+
+    CPLErr err = band_->RasterIO(GF_Read, t->i0, t->j0, t->width, t->height,
+                                 t->values.data(), t->width, t->height,
+                                 GDT_Float32, 0, 0);
+    if (err != CE_None) {
+        throw std::runtime_error("Error reading raster tile");
+    }
+
+    // Nodata is exposed as NaN so the usual NaN checks treat it as invalid
+    if (!std::isnan(nodata_)) {
+        const float nd = static_cast<float>(nodata_);
+        for (auto& v : t->values) {
+            if (v == nd) v = std::nanf("");
+        }
+    }
+    return t;
+}
+
+void RasterTileCache::evictToBudget() const {
+    // Always keep a few tiles so neighborhoods that straddle borders do not thrash
+    while (residentBytes_ > budget_ && lru_.size() > 4) {
+        int key = lru_.back();
+        lru_.pop_back();
+        auto it = tiles_.find(key);
+        residentBytes_ -= it->second.tile->values.size() * sizeof(float);
+        tiles_.erase(it);
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef RASTERTILECACHE_H
+#define RASTERTILECACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <iterator>
+#include "rasterbuffer.h"
+
+class GDALDataset;
+class GDALRasterBand;
+
+/**
+ * @struct RasterTile
+ * @brief One rectangular block of pixels read from disk.
+ *
+ * Pixels are row-major, Float32, and cover columns [i0, i0 + width) and
+ * rows [j0, j0 + height) of the full raster.
+ */
+struct RasterTile {
+    int i0 = 0;                 ///< First column covered by the tile.
+    int j0 = 0;                 ///< First row covered by the tile.
+    int width = 0;              ///< Number of columns in the tile.
+    int height = 0;             ///< Number of rows in the tile.
+    std::vector<float> values;  ///< Row-major pixels of the tile.
+
+    float at(int i, int j) const { return values[static_cast<size_t>(j - j0) * width + (i - i0)]; }
+    RasterSpan<const float> span() const { return RasterSpan<const float>(values.data(), width, height, width); }
+};
+
+/**
+ * @class RasterTileCache
+ * @brief Block-windowed, out-of-core access to the first band of a GDAL raster.
+ *
+ * Tiles follow the natural GDAL block layout of the file (strips are
+ * grouped into taller tiles) and are read on demand. Recently used tiles
+ * are kept in an LRU cache bounded by a memory budget, so rasters much
+ * larger than RAM can be scanned tile by tile or queried cell by cell.
+ * All accessors are thread-safe.
+ */
+class RasterTileCache {
+public:
+    /**
+     * @brief Open a raster for tiled access.
+     * @param filename Path to any GDAL-readable raster.
+     * @param memoryBudgetBytes Maximum bytes of pixels kept in the cache.
+     * @throw std::runtime_error if the file cannot be opened.
+     */
+    RasterTileCache(const std::string& filename, size_t memoryBudgetBytes);
+    ~RasterTileCache();
+
+    RasterTileCache(const RasterTileCache&) = delete;
+    RasterTileCache& operator=(const RasterTileCache&) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int tileWidth() const { return tileWidth_; }
+    int tileHeight() const { return tileHeight_; }
+    int tilesX() const { return tilesX_; }
+    int tilesY() const { return tilesY_; }
+    int tileCount() const { return tilesX_ * tilesY_; }
+
+    /// Nodata value declared by the band (NaN if none).
+    double nodata() const { return nodata_; }
+
+    /// Change the memory budget; evicts tiles immediately if needed.
+    void setMemoryBudget(size_t bytes);
+    size_t memoryBudget() const;
+
+    /// Number of tiles currently resident.
+    size_t residentTiles() const;
+
+    /**
+     * @brief Get the tile at tile coordinates (tx, ty), reading it if needed.
+     * @throw std::out_of_range for invalid tile coordinates.
+     * @throw std::runtime_error if GDAL fails to read the block.
+     */
+    std::shared_ptr<const RasterTile> tile(int tx, int ty) const;
+
+    /// Tile containing cell (i, j).
+    std::shared_ptr<const RasterTile> tileFor(int i, int j) const;
+
+    /// Value of cell (i, j); nodata is returned as NaN.
+    double value(int i, int j) const;
+
+    /**
+     * @brief Square neighborhood around a cell.
+     * @param i Column index of the center cell.
+     * @param j Row index of the center cell.
+     * @param radius Half-width of the window (1 gives a 3x3 block).
+     * @return (2r+1)x(2r+1) buffer; cells outside the raster are NaN.
+     */
+    RasterBuffer<float> neighborhood(int i, int j, int radius) const;
+
+    /**
+     * @class TileIterator
+     * @brief Forward iterator over all tiles in row-major tile order.
+     */
+    class TileIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::shared_ptr<const RasterTile>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = value_type;
+
+        TileIterator(const RasterTileCache* cache, int index) : cache_(cache), index_(index) {}
+        value_type operator*() const { return cache_->tile(index_ % cache_->tilesX_, index_ / cache_->tilesX_); }
+        TileIterator& operator++() { ++index_; return *this; }
+        TileIterator operator++(int) { TileIterator t = *this; ++index_; return t; }
+        bool operator==(const TileIterator& o) const { return index_ == o.index_ && cache_ == o.cache_; }
+        bool operator!=(const TileIterator& o) const { return !(*this == o); }
+
+    private:
+        const RasterTileCache* cache_;
+        int index_;
+    };
+
+    TileIterator begin() const { return TileIterator(this, 0); }
+    TileIterator end() const { return TileIterator(this, tileCount()); }
+
+private:
+    std::shared_ptr<const RasterTile> readTile(int tx, int ty) const;
+    void evictToBudget() const;
+
+    GDALDataset* dataset_ = nullptr;
+    GDALRasterBand* band_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    int tileWidth_ = 0;
+    int tileHeight_ = 0;
+    int tilesX_ = 0;
+    int tilesY_ = 0;
+    double nodata_;
+    size_t budget_;
+
+    mutable std::mutex mutex_;
+    mutable std::list<int> lru_;  ///< Tile indices, most recently used first.
+    struct Entry {
+        std::shared_ptr<const RasterTile> tile;
+        std::list<int>::iterator position;
+    };
+    mutable std::unordered_map<int, Entry> tiles_;
+    mutable size_t residentBytes_ = 0;
+};
+
+#endif // RASTERTILECACHE_H
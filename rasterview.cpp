@@ -0,0 +1,158 @@
+#include "rasterview.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+RasterView::RasterView(const GeoTiffHandler& source)
+    : source_(source), width_(source.width()), height_(source.height())
+{
+}
+
+RasterView::RasterView(const GeoTiffHandler& source, int i0, int j0, int width, int height)
+    : source_(source), i0_(i0), j0_(j0), width_(width), height_(height)
+{
+    if (i0 < 0 || j0 < 0 || width < 0 || height < 0 ||
+        i0 + width > source.width() || j0 + height > source.height()) {
+        throw std::out_of_range("RasterView: window outside source raster.");
+    }
+}
+
+RasterView RasterView::window(int i0, int j0, int width, int height) const {
+    if (i0 < 0 || j0 < 0 || width < 0 || height < 0 || i0 + width > width_ || j0 + height > height_) {
+        throw std::out_of_range("RasterView::window: window outside view.");
+    }
+    return RasterView(source_, i0_ + i0, j0_ + j0, width, height);
+}
+
+RasterView RasterView::withHalo(int radius) const {
+    const int i0 = std::max(0, i0_ - radius);
+    const int j0 = std::max(0, j0_ - radius);
+    const int i1 = std::min(source_.width(),  i0_ + width_  + radius);
+    const int j1 = std::min(source_.height(), j0_ + height_ + radius);
+    return RasterView(source_, i0, j0, i1 - i0, j1 - j0);
+}
+
+template <typename Fn>
+void RasterView::forEachRow(Fn&& fn) const {
+    if (!source_.isTiled() && source_.pixelType() == PixelType::Float32) {
+        RasterSpan<const float> s = span();
+        for (int j = 0; j < height_; ++j) fn(j, s.row(j));
+        return;
+    }
+    // Tiled or narrower pixels: one row at a time through cellValue
+    std::vector<float> row(width_);
+    for (int j = 0; j < height_; ++j) {
+        for (int i = 0; i < width_; ++i) row[i] = static_cast<float>(cellValue(i, j));
+        fn(j, row.data());
+    }
+}
+
+double RasterView::valueAt(double xCoord, double yCoord) const {
+    if (width_ < 2 || height_ < 2 || source_.x().empty() || source_.y().empty()) {
+        return std::nan("");
+    }
+
+    const double col = (xCoord - x(0)) / dx();
+    const double row = (yCoord - y(0)) / dy();
+    if (col < 0 || col >= width_ - 1 || row < 0 || row >= height_ - 1) {
+        return std::nan("");
+    }
+
+    const int i = static_cast<int>(std::floor(col));
+    const int j = static_cast<int>(std::floor(row));
+    const double fx = col - i;
+    const double fy = row - j;
+
+    const double q11 = cellValue(i, j);
+    const double q21 = cellValue(i + 1, j);
+    const double q12 = cellValue(i, j + 1);
+    const double q22 = cellValue(i + 1, j + 1);
+    if (std::isnan(q11) || std::isnan(q21) || std::isnan(q12) || std::isnan(q22)) {
+        return std::nan("");
+    }
+
+    return q11 * (1 - fx) * (1 - fy) + q21 * fx * (1 - fy) +
+           q12 * (1 - fx) * fy       + q22 * fx * fy;
+}
+
+std::pair<int,int> RasterView::indicesAt(double xCoord, double yCoord) const {
+    if (width_ == 0 || height_ == 0 || source_.x().empty() || source_.y().empty()) {
+        throw std::runtime_error("Coordinate arrays not initialized.");
+    }
+
+    const double xmin = std::min(x(0), x(width_ - 1));
+    const double xmax = std::max(x(0), x(width_ - 1));
+    const double ymin = std::min(y(0), y(height_ - 1));
+    const double ymax = std::max(y(0), y(height_ - 1));
+    if (xCoord < xmin || xCoord > xmax || yCoord < ymin || yCoord > ymax) {
+        throw std::out_of_range("Requested coordinate is outside the view.");
+    }
+
+    const int i = std::clamp(static_cast<int>(std::round((xCoord - x(0)) / dx())), 0, width_ - 1);
+    const int j = std::clamp(static_cast<int>(std::round((yCoord - y(0)) / dy())), 0, height_ - 1);
+    return {i, j};
+}
+
+RasterSpan<const float> RasterView::span() const {
+    return source_.data2D().subSpan(i0_, j0_, width_, height_);
+}
+
+int RasterView::countValidCells() const {
+    if (!source_.isTiled()) {
+        const ValidityMask& mask = source_.validity();
+        size_t n = 0;
+        for (int j = 0; j < height_; ++j) n += mask.countRange(j0_ + j, i0_, i0_ + width_);
+        return static_cast<int>(n);
+    }
+    return static_cast<int>(statistics().count);
+}
+
+RasterStatistics RasterView::statistics() const {
+    RasterStatistics stats;
+    forEachRow([&](int j, const float* row) {
+        stats.add(rowStatistics(row, width_), 0, j);
+    });
+    return stats;
+}
+
+std::tuple<int,int,double> RasterView::minCell() const {
+    const RasterStatistics stats = statistics();
+    return {stats.minI, stats.minJ, stats.min};
+}
+
+std::tuple<int,int,double> RasterView::maxCell() const {
+    const RasterStatistics stats = statistics();
+    return {stats.maxI, stats.maxJ, stats.max};
+}
+
+double RasterView::area() const {
+    return static_cast<double>(countValidCells()) * std::fabs(dx()) * std::fabs(dy());
+}
+
+std::vector<Node> RasterView::nodes(const RasterView* valueView) const {
+    if (valueView && (valueView->width() != width_ || valueView->height() != height_)) {
+        throw std::runtime_error("RasterView::nodes: view dimensions do not match.");
+    }
+
+    std::vector<Node> out;
+    forEachRow([&](int j, const float* row) {
+        for (int i = 0; i < width_; ++i) {
+            if (std::isnan(row[i])) continue; // skip invalid cell
+            const double value = valueView ? valueView->cellValue(i, j) : row[i];
+            out.emplace_back(x(i), y(j), value);
+        }
+    });
+    return out;
+}
+
+GeoTiffHandler RasterView::materialize() const {
+    return source_.subset(i0_, j0_, width_, height_);
+}
+
+void RasterView::saveAs(const std::string& filename, RasterFormat format) const {
+    materialize().saveAs(filename, format);
+}
+
+void RasterView::saveAs(const std::string& filename, const GeoTiffWriteOptions& options) const {
+    materialize().saveAs(filename, options);
+}
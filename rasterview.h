@@ -0,0 +1,129 @@
+#ifndef RASTERVIEW_H
+#define RASTERVIEW_H
+
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "geotiffhandler.h"
+
+/**
+ * @class RasterView
+ * @brief Zero-copy rectangular window onto a GeoTiffHandler.
+ *
+ * A view holds a (copy-on-write, so pixel-sharing) copy of its source plus
+ * an offset and extent. Cell (i, j) of the view is cell (offsetI() + i,
+ * offsetJ() + j) of the source, and coordinates, cell sizes and projection
+ * come from the source, so the view reads exactly like a cropped raster.
+ * Cropping, tiling and halo access never copy pixels; materialize() (and
+ * saveAs, which uses it) is the only place a window is copied out.
+ *
+ * Views work on tiled sources too; cells are then read through the
+ * source's tile cache.
+ */
+class RasterView {
+public:
+    /// View of the whole source raster.
+    explicit RasterView(const GeoTiffHandler& source);
+
+    /**
+     * @brief View of a window of the source raster.
+     * @param source Raster to look into (shared, not copied).
+     * @param i0 First column of the window.
+     * @param j0 First row of the window.
+     * @param width Number of columns.
+     * @param height Number of rows.
+     * @throw std::out_of_range if the window exceeds the source.
+     */
+    RasterView(const GeoTiffHandler& source, int i0, int j0, int width, int height);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int offsetI() const { return i0_; }
+    int offsetJ() const { return j0_; }
+    const GeoTiffHandler& source() const { return source_; }
+
+    /** @name Geo-referencing */
+    ///@{
+    double x(int i) const { return source_.x()[i0_ + i]; }  ///< X of the center of column i.
+    double y(int j) const { return source_.y()[j0_ + j]; }  ///< Y of the center of row j.
+    double dx() const { return source_.dx(); }
+    double dy() const { return source_.dy(); }
+    const std::string& projection() const { return source_.projection(); }
+    ///@}
+
+    /** @name Sub-views */
+    ///@{
+    /**
+     * @brief View of a window of this view (indices relative to this view).
+     * @throw std::out_of_range if the window exceeds this view.
+     */
+    RasterView window(int i0, int j0, int width, int height) const;
+
+    /// This view grown by radius cells on every side, clipped to the source.
+    RasterView withHalo(int radius) const;
+    ///@}
+
+    /** @name Reading */
+    ///@{
+    /// Value of view cell (i, j) (NaN for nodata).
+    double cellValue(int i, int j) const { return source_.cellValue(i0_ + i, j0_ + j); }
+
+    /**
+     * @brief Bilinearly interpolated value at a world coordinate.
+     * @return NaN outside the view or next to nodata.
+     */
+    double valueAt(double xCoord, double yCoord) const;
+
+    /**
+     * @brief Nearest view cell to a world coordinate.
+     * @return Pair (i, j) relative to the view.
+     * @throw std::out_of_range if the coordinate is outside the view.
+     */
+    std::pair<int,int> indicesAt(double xCoord, double yCoord) const;
+
+    /**
+     * @brief Strided view of the pixels.
+     * @throw std::runtime_error if the source is tiled or not Float32.
+     */
+    RasterSpan<const float> span() const;
+    ///@}
+
+    /** @name Statistics */
+    ///@{
+    int countValidCells() const;
+    RasterStatistics statistics() const;         ///< Cells relative to the view.
+    std::tuple<int,int,double> minCell() const;  ///< (i, j, value) relative to the view.
+    std::tuple<int,int,double> maxCell() const;  ///< (i, j, value) relative to the view.
+    double area() const;                         ///< Area of valid cells.
+    ///@}
+
+    /**
+     * @brief Nodes at the centers of valid cells.
+     * @param valueView View supplying node values (same size); this view if null.
+     * @throw std::runtime_error if valueView has a different size.
+     */
+    std::vector<Node> nodes(const RasterView* valueView = nullptr) const;
+
+    /** @name Materialization */
+    ///@{
+    /// Copy the window out into a standalone in-memory raster.
+    GeoTiffHandler materialize() const;
+
+    void saveAs(const std::string& filename, RasterFormat format = RasterFormat::GeoTiff) const;
+    void saveAs(const std::string& filename, const GeoTiffWriteOptions& options) const;
+    ///@}
+
+private:
+    /// Call fn(j, row) for every view row, row pointing at width() floats.
+    template <typename Fn>
+    void forEachRow(Fn&& fn) const;
+
+    GeoTiffHandler source_;
+    int i0_ = 0;
+    int j0_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+};
+
+#endif // RASTERVIEW_H
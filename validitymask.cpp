@@ -0,0 +1,109 @@
+#include "validitymask.h"
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+
+ValidityMask::ValidityMask(int width, int height, bool valid)
+    : width_(width), height_(height), wordsPerRow_((width + 63) / 64),
+    words_(static_cast<size_t>(wordsPerRow_) * height, 0)
+{
+    if (valid && wordsPerRow_ > 0) {
+        // Full words all ones, the last word of each row only up to the width
+        const int tail = width_ - (wordsPerRow_ - 1) * 64;
+        const uint64_t last = tail == 64 ? ~uint64_t(0) : (uint64_t(1) << tail) - 1;
+        for (int j = 0; j < height_; ++j) {
+            uint64_t* r = words_.data() + static_cast<size_t>(j) * wordsPerRow_;
+            std::fill(r, r + wordsPerRow_ - 1, ~uint64_t(0));
+            r[wordsPerRow_ - 1] = last;
+        }
+    }
+}
+
+ValidityMask ValidityMask::fromPixels(const PixelBuffer& pixels) {
+    ValidityMask mask(pixels.width(), pixels.height(), false);
+    const double nodata = pixels.noData();
+    pixels.visit([&mask, nodata](const auto& b) {
+        using T = typename std::decay_t<decltype(b)>::value_type;
+        const bool useNodata = std::is_integral<T>::value && !std::isnan(nodata);
+        for (int j = 0; j < mask.height_; ++j) {
+            const T* src = b.row(j);
+            uint64_t* dst = mask.words_.data() + static_cast<size_t>(j) * mask.wordsPerRow_;
+            for (int w = 0; w < mask.wordsPerRow_; ++w) {
+                const int i0 = w * 64;
+                const int n = std::min(64, mask.width_ - i0);
+                uint64_t bits = 0;
+                for (int k = 0; k < n; ++k) {
+                    const double v = static_cast<double>(src[i0 + k]);
+                    const bool ok = useNodata ? (v != nodata) : !std::isnan(v);
+                    bits |= uint64_t(ok) << k;
+                }
+                dst[w] = bits;
+            }
+        }
+    });
+    return mask;
+}
+
+size_t ValidityMask::count() const {
+    size_t n = 0;
+    for (uint64_t w : words_) n += popCount(w);
+    return n;
+}
+
+size_t ValidityMask::countRow(int j) const {
+    size_t n = 0;
+    const uint64_t* r = row(j);
+    for (int w = 0; w < wordsPerRow_; ++w) n += popCount(r[w]);
+    return n;
+}
+
+size_t ValidityMask::countRange(int j, int i0, int i1) const {
+    if (i0 >= i1) return 0;
+    const uint64_t* r = row(j);
+    const int w0 = i0 >> 6, w1 = (i1 - 1) >> 6;
+    const uint64_t first = ~uint64_t(0) << (i0 & 63);
+    const uint64_t last = ~uint64_t(0) >> (63 - ((i1 - 1) & 63));
+    if (w0 == w1) return popCount(r[w0] & first & last);
+
+    size_t n = popCount(r[w0] & first) + popCount(r[w1] & last);
+    for (int w = w0 + 1; w < w1; ++w) n += popCount(r[w]);
+    return n;
+}
+
+bool ValidityMask::bounds(int& i0, int& j0, int& i1, int& j1) const {
+    int minI = width_, maxI = -1, minJ = height_, maxJ = -1;
+    for (int j = 0; j < height_; ++j) {
+        const uint64_t* r = row(j);
+        int first = -1, last = -1;
+        for (int w = 0; w < wordsPerRow_; ++w) {
+            if (r[w]) { first = w * 64 + countTrailingZeros(r[w]); break; }
+        }
+        if (first < 0) continue;
+        for (int w = wordsPerRow_ - 1; w >= 0; --w) {
+            if (r[w]) { last = w * 64 + 63 - countLeadingZeros(r[w]); break; }
+        }
+        minI = std::min(minI, first);
+        maxI = std::max(maxI, last);
+        if (minJ == height_) minJ = j;
+        maxJ = j;
+    }
+    if (maxI < 0) return false;
+    i0 = minI; j0 = minJ; i1 = maxI; j1 = maxJ;
+    return true;
+}
+
+ValidityMask& ValidityMask::operator&=(const ValidityMask& other) {
+    if (other.width_ != width_ || other.height_ != height_) {
+        throw std::invalid_argument("ValidityMask: size mismatch.");
+    }
+    for (size_t k = 0; k < words_.size(); ++k) words_[k] &= other.words_[k];
+    return *this;
+}
+
+ValidityMask& ValidityMask::operator|=(const ValidityMask& other) {
+    if (other.width_ != width_ || other.height_ != height_) {
+        throw std::invalid_argument("ValidityMask: size mismatch.");
+    }
+    for (size_t k = 0; k < words_.size(); ++k) words_[k] |= other.words_[k];
+    return *this;
+}
@@ -0,0 +1,99 @@
+#ifndef VALIDITYMASK_H
+#define VALIDITYMASK_H
+
+#include <cstdint>
+#include <vector>
+#include "bitops.h"
+#include "pixelbuffer.h"
+
+/**
+ * @class ValidityMask
+ * @brief Packed one-bit-per-cell record of which raster cells hold data.
+ *
+ * Bits are stored row by row in 64-bit words; each row starts on a new
+ * word so rows can be scanned, counted and skipped independently. Bit
+ * (i % 64) of word (i / 64) of row j is set when cell (i, j) is valid.
+ * Counting uses one popcount per word, and scans skip whole 64-cell words
+ * that hold no valid cell.
+ */
+class ValidityMask {
+public:
+    ValidityMask() = default;
+
+    /// Mask of width x height cells, all valid or all invalid.
+    ValidityMask(int width, int height, bool valid);
+
+    /**
+     * @brief Mask of the cells holding data.
+     *
+     * Float cells are invalid when NaN; integer cells when they equal the
+     * buffer's nodata value.
+     */
+    static ValidityMask fromPixels(const PixelBuffer& pixels);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int wordsPerRow() const { return wordsPerRow_; }
+
+    bool valid(int i, int j) const {
+        return (words_[static_cast<size_t>(j) * wordsPerRow_ + (i >> 6)] >> (i & 63)) & 1u;
+    }
+
+    void set(int i, int j, bool valid) {
+        uint64_t& w = words_[static_cast<size_t>(j) * wordsPerRow_ + (i >> 6)];
+        const uint64_t bit = uint64_t(1) << (i & 63);
+        w = valid ? (w | bit) : (w & ~bit);
+    }
+
+    /// Words of row j (bits past the row width are always zero).
+    const uint64_t* row(int j) const { return words_.data() + static_cast<size_t>(j) * wordsPerRow_; }
+
+    /// Number of valid cells.
+    size_t count() const;
+
+    /// Number of valid cells in row j.
+    size_t countRow(int j) const;
+
+    /// Number of valid cells in columns [i0, i1) of row j.
+    size_t countRange(int j, int i0, int i1) const;
+
+    /// True if every cell is valid.
+    bool allValid() const { return count() == static_cast<size_t>(width_) * height_; }
+
+    /**
+     * @brief Smallest rectangle holding every valid cell.
+     * @param[out] i0 First column.
+     * @param[out] j0 First row.
+     * @param[out] i1 Last column (inclusive).
+     * @param[out] j1 Last row (inclusive).
+     * @return False if no cell is valid (outputs untouched).
+     */
+    bool bounds(int& i0, int& j0, int& i1, int& j1) const;
+
+    /// Call fn(i, j) for every valid cell, row by row, skipping empty words.
+    template <typename Fn>
+    void forEachValid(Fn&& fn) const {
+        for (int j = 0; j < height_; ++j) {
+            const uint64_t* r = row(j);
+            for (int w = 0; w < wordsPerRow_; ++w) {
+                uint64_t bits = r[w];
+                while (bits) {
+                    const int b = countTrailingZeros(bits);
+                    fn(w * 64 + b, j);
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    ValidityMask& operator&=(const ValidityMask& other);
+    ValidityMask& operator|=(const ValidityMask& other);
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int wordsPerRow_ = 0;
+    std::vector<uint64_t> words_;
+};
+
+#endif // VALIDITYMASK_H